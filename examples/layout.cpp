@@ -0,0 +1,254 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "rendirt.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace rd = rendirt;
+
+// Hardware cache miss counter for the calling thread. Reports nothing where
+// perf events are not available (non-Linux systems, restricted containers).
+class CacheMisses {
+public:
+    CacheMisses() {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = int(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~CacheMisses() {
+#ifdef __linux__
+        if (fd_ >= 0)
+            ::close(fd_);
+#endif
+    }
+
+    bool available() const {
+        return fd_ >= 0;
+    }
+
+    void start() {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ::ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    long long stop() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ::ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(fd_, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// Simulated cache behaviour, reported on every platform. Vertex misses per
+// face count transformed vertices when model is rendered as an IndexedMesh,
+// through the FIFO cache that render() uses
+double vertexMissesPerFace(rd::Model const& model) {
+    const rd::IndexedMesh mesh(model);
+    std::vector<uint32_t> cache(rd::IndexedMesh::VertexCacheSize, uint32_t(-1));
+    size_t next = 0, missCount = 0;
+
+    for (uint32_t index: mesh.indices) {
+        if (std::find(cache.begin(), cache.end(), index) != cache.end())
+            continue;
+
+        cache[next] = index;
+        next = (next + 1) % cache.size();
+        ++missCount;
+    }
+
+    return mesh.size() ? double(missCount)/double(mesh.size()) : 0.0;
+}
+
+// Tile misses count faces that land on a framebuffer tile of 16x16 px which
+// is not among the 64 most recently used ones (color and depth of 64 tiles
+// fill 128 KB), taking the tile under the centroid of each face
+size_t tileMisses(rd::Model const& model, glm::mat4 const& modelViewProj, size_t width, size_t height) {
+    static constexpr size_t TileSize = 16, TileCount = 64;
+    const size_t tilesPerRow = (width + TileSize - 1)/TileSize;
+
+    std::vector<size_t> recent;
+    size_t missCount = 0;
+
+    for (auto const& face: model) {
+        const glm::vec4 p = modelViewProj*glm::vec4((face.vertex[0] + face.vertex[1] + face.vertex[2])/3.0f, 1.0f);
+        if (p.w <= 0.0f || glm::any(glm::greaterThan(glm::abs(glm::vec3(p)), glm::vec3(p.w))))
+            continue;
+
+        const size_t x = std::min(size_t((p.x/p.w*0.5f + 0.5f)*float(width)), width - 1);
+        const size_t y = std::min(size_t((p.y/p.w*0.5f + 0.5f)*float(height)), height - 1);
+        const size_t tile = (y/TileSize)*tilesPerRow + x/TileSize;
+
+        auto it = std::find(recent.begin(), recent.end(), tile);
+        if (it == recent.end()) {
+            ++missCount;
+            if (recent.size() == TileCount)
+                recent.pop_back();
+            it = recent.insert(recent.begin(), tile);
+        }
+
+        std::rotate(recent.begin(), it, it + 1);
+    }
+
+    return missCount;
+}
+
+void benchmark(char const* name, rd::Model const& model, CacheMisses& misses) {
+    // Render a turntable of 16 views at 800x600 px
+    std::vector<rd::Color> colorBuffer(800*600);
+    rd::Image<rd::Color> img(colorBuffer.data(), 800, 600);
+
+    std::vector<float> depthBuffer(800*600);
+    rd::Image<float> depth(depthBuffer.data(), 800, 600);
+
+    const glm::vec3 diagonal = model.boundingBox().to - model.boundingBox().from;
+    const float distance = glm::length(diagonal);
+
+    const rd::Projection proj(
+        rd::Projection::Perspective,
+        60.0f/180.0f*glm::pi<float>(), img.width, img.height,
+        0.1f, 2.0f*distance);
+
+    const auto shader = rd::shaders::diffuseDirectional(
+        glm::vec3(0.0f, -1.0f, -1.0f), rd::Color(40, 40, 40, 255), rd::Color(200, 200, 200, 255));
+
+    using frac_ms = std::chrono::duration<float, std::milli>;
+    float time = 0.0f;
+    long long missCount = 0;
+    size_t tileMissCount = 0;
+
+    for (int i = 0; i < 16; ++i) {
+        const float angle = float(i)/16.0f*2.0f*glm::pi<float>();
+        const rd::Camera view(
+            model.center() + distance*glm::vec3(std::cos(angle), 0.5f, std::sin(angle)),
+            model.center(),
+            { 0.0f, 1.0f, 0.0f });
+
+        img.clear(rd::Color(0, 0, 0, 255));
+        depth.clear(1.0f);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        misses.start();
+        rd::render(img, depth, model, proj*view, shader);
+        missCount += misses.stop();
+        time += std::chrono::duration_cast<frac_ms>(std::chrono::high_resolution_clock::now() - start).count();
+
+        tileMissCount += tileMisses(model, proj*view, img.width, img.height);
+    }
+
+    std::cout << name << ":\t" << time/16.0f << " ms/frame";
+    if (misses.available())
+        std::cout << '\t' << double(missCount)/16.0 << " cache misses/frame";
+    std::cout << "\tsimulated: " << vertexMissesPerFace(model) << " vertex misses/face, "
+              << double(tileMissCount)/16.0 << " tile misses/frame" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    // Compares render performance with different face layouts
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " MODEL.stl" << std::endl;
+        return -1;
+    }
+
+    std::ifstream file(argv[1], std::ifstream::binary);
+    if (!file) {
+        std::cerr << argv[1] << ": cannot open file for reading: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    rd::Model model;
+    rd::Model::Error err = model.loadSTL(file);
+    if (err != rd::Model::Ok) {
+        std::cerr << argv[1] << ": " << rd::Model::errorString(err) << std::endl;
+        return -1;
+    }
+
+    std::cerr << "Face count: " << model.size() << std::endl;
+
+    CacheMisses misses;
+    if (!misses.available())
+        std::cerr << "Hardware cache miss counters not available, reporting times and simulated misses only" << std::endl;
+
+    using frac_ms = std::chrono::duration<float, std::milli>;
+
+    benchmark("original", model, misses);
+
+    // Exporter order is often random in space: simulate the worst case
+    rd::Model shuffled = model;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+    benchmark("shuffled", shuffled, misses);
+
+    rd::Model sorted = shuffled;
+    auto start = std::chrono::high_resolution_clock::now();
+    rd::sortFacesMorton(sorted);
+    std::cerr << "Morton sort: "
+              << std::chrono::duration_cast<frac_ms>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms" << std::endl;
+    benchmark("morton", sorted, misses);
+
+    rd::Model optimized = shuffled;
+    start = std::chrono::high_resolution_clock::now();
+    rd::optimizeFaceOrder(optimized);
+    std::cerr << "Face order optimization: "
+              << std::chrono::duration_cast<frac_ms>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms" << std::endl;
+    benchmark("optimized", optimized, misses);
+
+    return 0;
+}
@@ -43,7 +43,7 @@ namespace tiff {
     template<typename T, typename U>
     inline T left_aligned_cast(U const& value) {
         static constexpr size_t maxSize = (sizeof(U) > sizeof(T)) ? sizeof(U) : sizeof(T);
-        std::uint8_t tmp[maxSize];
+        std::uint8_t tmp[maxSize] = {};
         *reinterpret_cast<U*>(tmp) = value;
         return *reinterpret_cast<T*>(tmp);
     }
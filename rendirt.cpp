@@ -30,16 +30,23 @@
 
 #include "rendirt.hpp"
 
+#include <glm/mat4x3.hpp>
 #include <glm/gtc/matrix_access.hpp>
 #include <glm/gtx/normal.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <map>
 #include <numeric>
+#include <thread>
+#include <unordered_map>
 
 using namespace rendirt;
 
@@ -77,7 +84,9 @@ namespace {
 Model::Error Model::loadTextSTL(std::istream& stream, bool useNormals, bool verified) {
     std::string tok;
 
+    // Keep capacity, so that reloading does not reallocate
     clear();
+    boundingBox_ = AABB();
 
     stream >> std::skipws;
 
@@ -187,13 +196,13 @@ Model::Error Model::loadTextSTL(std::istream& stream, bool useNormals, bool veri
     if (tok != "endsolid")
         return tok.empty() ? FileTruncated : UnexpectedToken;
 
-    shrink_to_fit();
     return Ok;
 }
 
 Model::Error Model::loadBinarySTL(std::istream& stream, bool useNormals, size_t skipped) {
-    // Reassign to free excess memory
-    *this = Model();
+    // Keep capacity, so that reloading does not reallocate
+    clear();
+    boundingBox_ = AABB();
 
     // Skip header
     stream.ignore(80 - skipped);
@@ -204,7 +213,6 @@ Model::Error Model::loadBinarySTL(std::istream& stream, bool useNormals, size_t
     if (stream.gcount() < std::streamsize(sizeof(uint32_t)))
         return FileTruncated;
 
-    reserve(size);
     resize(size);
 
     auto first = begin(), last = end();
@@ -282,98 +290,2887 @@ char const* Model::errorString(Error err) {
     return strings[(unsigned int) err];
 }
 
-// Renderer
-size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
-                       Model const& model, glm::mat4 const& modelViewProj,
-                       Shader const& shader, CullingMode cullingMode)
-{
-    assert(color.width == depth.width && color.height == depth.height);
+// FaceView methods
+FaceView FaceView::fromBinarySTL(void const* data, size_t size, bool useNormals) {
+    static constexpr size_t headerSize = 80 + sizeof(uint32_t);
 
-    size_t faceCount = 0;
+    uint32_t count = 0;
+    if (size >= headerSize)
+        std::memcpy(&count, static_cast<unsigned char const*>(data) + 80, sizeof(uint32_t));
+
+    if (size < headerSize || (size - headerSize)/BinarySTLStride < count)
+        return FaceView(data, 0, BinarySTLStride, useNormals);
 
-    using vec2s = glm::vec<2, size_t>;
-    const vec2s imgSize(color.width, color.height);
-    const glm::vec2 imgSizef(imgSize);
+    return FaceView(static_cast<unsigned char const*>(data) + headerSize, count, BinarySTLStride, useNormals);
+}
 
-    glm::vec2 sampleStep = glm::vec2(2.0f, -2.0f)/imgSizef;
+// Scene methods
+namespace {
+    // Returns the bounding box of box transformed by matrix
+    AABB transformBox(AABB const& box, glm::mat4 const& matrix) {
+        const glm::vec3 center = glm::vec3(matrix*glm::vec4((box.from + box.to)*0.5f, 1.0f));
+        const glm::vec3 extent = (box.to - box.from)*0.5f;
 
-    for (auto const& face: model) {
-        glm::vec4 clipf[3] = {
-            modelViewProj * glm::vec4(face.vertex[0], 1.0f),
-            modelViewProj * glm::vec4(face.vertex[1], 1.0f),
-            modelViewProj * glm::vec4(face.vertex[2], 1.0f)
-        };
+        const glm::mat3 linear(matrix);
+        const glm::vec3 newExtent =
+            glm::abs(linear[0])*extent.x + glm::abs(linear[1])*extent.y + glm::abs(linear[2])*extent.z;
 
-        clipf[0] /= clipf[0].w; clipf[1] /= clipf[1].w; clipf[2] /= clipf[2].w;
+        return { center - newExtent, center + newExtent };
+    }
 
-        // Face culling by winding detection
-        const float doubleArea = ((clipf[0].y - clipf[1].y)*clipf[2].x + (clipf[1].x - clipf[0].x)*clipf[2].y + (clipf[0].x*clipf[1].y - clipf[0].y*clipf[1].x));
-        if ((cullingMode == CullCW && doubleArea <= 0.0f) || (cullingMode == CullCCW && doubleArea > 0.0f))
-            continue;
+    glm::vec3 centroid(AABB const& box) {
+        return (box.from + box.to)*0.5f;
+    }
+} /* namespace */
 
-        AABB brect = {
-            glm::min(clipf[0], glm::min(clipf[1], clipf[2])),
-            glm::max(clipf[0], glm::max(clipf[1], clipf[2]))
-        };
+size_t Scene::add(FaceView const& faces, AABB const& localBounds, glm::mat4 const& transform) {
+    objects_.push_back(Object{ faces, localBounds, transform, transformBox(localBounds, transform) });
+    return objects_.size() - 1;
+}
+
+void Scene::build() {
+    order_.resize(objects_.size());
+    std::iota(order_.begin(), order_.end(), 0);
+
+    nodes_.clear();
+    if (objects_.empty())
+        return;
+
+    nodes_.reserve(2*objects_.size());
+    nodes_.emplace_back();
+    buildNode(0, 0, uint32_t(objects_.size()));
+}
+
+void Scene::buildNode(size_t node, uint32_t first, uint32_t count) {
+    static constexpr uint32_t leafSize = 2;
+
+    AABB bounds = objects_[order_[first]].bounds;
+    AABB centers = { centroid(bounds), centroid(bounds) };
+
+    for (uint32_t i = first + 1; i < first + count; ++i) {
+        AABB const& box = objects_[order_[i]].bounds;
+        bounds.from = glm::min(bounds.from, box.from);
+        bounds.to = glm::max(bounds.to, box.to);
+        centers.from = glm::min(centers.from, centroid(box));
+        centers.to = glm::max(centers.to, centroid(box));
+    }
+
+    if (count <= leafSize) {
+        nodes_[node] = Node{ bounds, first, count };
+        return;
+    }
+
+    // Median split along the axis of largest centroid extent
+    const glm::vec3 extent = centers.to - centers.from;
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+    const uint32_t half = count/2;
+
+    std::nth_element(order_.begin() + first, order_.begin() + first + half, order_.begin() + first + count,
+        [this, axis](uint32_t a, uint32_t b) {
+            return centroid(objects_[a].bounds)[axis] < centroid(objects_[b].bounds)[axis];
+        });
+
+    const uint32_t child = uint32_t(nodes_.size());
+    nodes_.resize(nodes_.size() + 2);
+    nodes_[node] = Node{ bounds, child, 0 };
+
+    buildNode(child, first, half);
+    buildNode(child + 1, first + half, count - half);
+}
+
+// Instancing
+namespace {
+    struct Vec3Hash {
+        size_t operator()(glm::vec3 const& v) const {
+            uint32_t bits[3];
+            std::memcpy(bits, &v, sizeof(bits));
+            return (size_t(bits[0])*73856093u) ^ (size_t(bits[1])*19349663u) ^ (size_t(bits[2])*83492791u);
+        }
+    };
+
+    // Assigns the same index to bitwise equal vertices. Returns three
+    // indices per face and sets vertexCount to the number of distinct ones
+    std::vector<uint32_t> weldVertices(Model const& model, size_t& vertexCount) {
+        std::unordered_map<glm::vec3, uint32_t, Vec3Hash> index;
+        index.reserve(model.size()/2);
+
+        std::vector<uint32_t> indices(3*model.size());
+        for (size_t i = 0; i < model.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                // Adding zero turns -0 into +0, so that equal values hash equally
+                const glm::vec3 v = model[i].vertex[k] + glm::vec3(0.0f);
+                indices[3*i + k] = index.emplace(v, uint32_t(index.size())).first->second;
+            }
+        }
+
+        vertexCount = index.size();
+        return indices;
+    }
+
+    uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    }
+
+    float faceArea(Face const& face) {
+        return 0.5f*glm::length(glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]));
+    }
+
+    glm::vec3 faceCenter(Face const& face) {
+        return (face.vertex[0] + face.vertex[1] + face.vertex[2])/3.0f;
+    }
+
+    // Rigid-invariant description of a component: face count, area, and
+    // invariants of the second moment of its vertices about the centroid
+    // (trace, sum of principal minors, determinant). Vertex counts are left
+    // out: copies may differ in how many vertices closer than the tolerance
+    // happened to be bitwise equal and welded
+    struct Signature {
+        size_t faces;
+        float area, moments[3];
+        glm::vec3 centroid;
+    };
+
+    Signature signature(Model const& model, std::vector<uint32_t> const& faces) {
+        Signature sig = { faces.size(), 0.0f, { 0.0f, 0.0f, 0.0f }, glm::vec3(0.0f) };
+
+        for (uint32_t f: faces) {
+            Face const& face = model[f];
+            sig.area += faceArea(face);
+            sig.centroid += face.vertex[0] + face.vertex[1] + face.vertex[2];
+        }
+
+        sig.centroid /= float(3*faces.size());
+
+        glm::mat3 m(0.0f);
+        for (uint32_t f: faces)
+            for (int k = 0; k < 3; ++k) {
+                const glm::vec3 d = model[f].vertex[k] - sig.centroid;
+                m += glm::outerProduct(d, d);
+            }
+
+        m /= float(3*faces.size());
+        sig.moments[0] = m[0][0] + m[1][1] + m[2][2];
+        sig.moments[1] = m[0][0]*m[1][1] - m[0][1]*m[1][0] + m[1][1]*m[2][2] - m[1][2]*m[2][1] + m[0][0]*m[2][2] - m[0][2]*m[2][0];
+        sig.moments[2] = glm::determinant(m);
+        return sig;
+    }
+
+    bool similar(float a, float b, float tolerance) {
+        return std::abs(a - b) <= tolerance*std::max(std::abs(a), std::abs(b)) + std::numeric_limits<float>::min();
+    }
+
+    bool similar(Signature const& a, Signature const& b) {
+        static constexpr float tolerance = 1e-3f;
+        return a.faces == b.faces && similar(a.area, b.area, tolerance) &&
+               similar(a.moments[0], b.moments[0], tolerance) &&
+               similar(a.moments[1], b.moments[1], tolerance) &&
+               similar(a.moments[2], b.moments[2], tolerance);
+    }
+
+    // Orthonormal frame spanned by a face, taking its vertices from first
+    glm::mat3 faceFrame(Face const& face, int first) {
+        glm::vec3 const& v0 = face.vertex[first];
+        const glm::vec3 u = glm::normalize(face.vertex[(first + 1) % 3] - v0);
+        const glm::vec3 w = glm::normalize(glm::cross(u, face.vertex[(first + 2) % 3] - v0));
+        return glm::mat3(u, glm::cross(w, u), w);
+    }
+
+    // Faces (indices into the model) and distinct welded vertices of a
+    // connected component
+    struct Component {
+        std::vector<uint32_t> faces, vertices;
+    };
+
+    // Vertices of a component hashed on a uniform grid around its centroid,
+    // so that the vertex nearest to a position is found regardless of order.
+    // Vertices closer than the merge distance (left unwelded by rounding)
+    // stand for the first of them, so that both sides of a match agree.
+    class VertexGrid {
+    public:
+        void build(std::vector<glm::vec3> const& positions, std::vector<uint32_t> const& vertices,
+                   glm::vec3 const& origin, float tolerance, float mergeDistance,
+                   std::vector<uint32_t>& representative)
+        {
+            positions_ = &positions;
+            representative_ = &representative;
+            origin_ = origin;
+
+            // Cells at least twice the tolerance wide: lookups probe at most
+            // two cells per axis
+            cellSize_ = 2.0f*std::max(tolerance, mergeDistance);
+            if (!(cellSize_ > 0.0f))
+                cellSize_ = 1.0f;
+
+            cells_.clear();
+            cells_.reserve(vertices.size());
+            for (uint32_t v: vertices)
+                cells_[key(cellOf(positions[v]))].push_back(v);
+
+            for (uint32_t v: vertices) {
+                uint32_t first = v;
+                visit(positions[v], mergeDistance, [&first](uint32_t w, float) {
+                    first = std::min(first, w);
+                });
+                representative[v] = first;
+            }
+        }
+
+        uint32_t representative(uint32_t v) const {
+            return (*representative_)[v];
+        }
+
+        // Returns the representative of the vertex nearest to p within
+        // tolerance, or uint32_t(-1)
+        uint32_t nearest(glm::vec3 const& p, float tolerance) const {
+            uint32_t found = uint32_t(-1);
+            float distance2 = std::numeric_limits<float>::infinity();
+            visit(p, tolerance, [&found, &distance2](uint32_t w, float d2) {
+                if (d2 < distance2) {
+                    found = w;
+                    distance2 = d2;
+                }
+            });
+            return (found != uint32_t(-1)) ? representative(found) : found;
+        }
+
+    private:
+        // Calls fn(vertex, squared distance) for vertices within radius of p
+        template <typename Fn>
+        void visit(glm::vec3 const& p, float radius, Fn fn) const {
+            const glm::ivec3 from = cellOf(p - radius), to = cellOf(p + radius);
+            const float radius2 = radius*radius;
+
+            for (int z = from.z; z <= to.z; ++z)
+                for (int y = from.y; y <= to.y; ++y)
+                    for (int x = from.x; x <= to.x; ++x) {
+                        auto it = cells_.find(key(glm::ivec3(x, y, z)));
+                        if (it == cells_.end())
+                            continue;
+
+                        for (uint32_t v: it->second) {
+                            const glm::vec3 d = (*positions_)[v] - p;
+                            const float d2 = glm::dot(d, d);
+                            if (d2 <= radius2)
+                                fn(v, d2);
+                        }
+                    }
+        }
+
+        glm::ivec3 cellOf(glm::vec3 const& p) const {
+            return glm::ivec3(glm::floor((p - origin_)/cellSize_));
+        }
+
+        static uint64_t key(glm::ivec3 const& c) {
+            return (uint64_t(uint32_t(c.x))*73856093u) ^ (uint64_t(uint32_t(c.y))*19349663u << 21) ^
+                   (uint64_t(uint32_t(c.z))*83492791u << 42);
+        }
+
+        std::vector<glm::vec3> const* positions_ = nullptr;
+        std::vector<uint32_t>* representative_ = nullptr;
+        glm::vec3 origin_;
+        float cellSize_ = 1.0f;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> cells_;
+    };
+
+    // Welded indices of a face, rotated so that the smallest comes first
+    // (which keeps the winding)
+    std::array<uint32_t, 3> canonicalFace(uint32_t a, uint32_t b, uint32_t c) {
+        if (b < a && b < c)
+            return {{ b, c, a }};
+        if (c < a && c < b)
+            return {{ c, a, b }};
+        return {{ a, b, c }};
+    }
+
+    // Finds the rigid transform mapping component a onto component b,
+    // whatever the order of their faces and of the vertices within faces.
+    // The largest face of a is paired with each face of b with similar area
+    // and distance from the centroid, in each of its three rotations; the
+    // rotation between their frames is accepted when it maps every vertex of
+    // a onto a vertex of b and every face onto a face. map is scratch space
+    // with one entry per welded vertex.
+    bool matchRigid(Model const& model, std::vector<uint32_t> const& indices, std::vector<glm::vec3> const& positions,
+                    Component const& a, Signature const& sa, Component const& b, Signature const& sb,
+                    VertexGrid const& grid, float tolerance, std::vector<uint32_t>& map, glm::mat4& transform)
+    {
+        uint32_t largest = 0;
+        float largestArea = 0.0f;
+        for (uint32_t f: a.faces) {
+            const float area = faceArea(model[f]);
+            if (area > largestArea) {
+                largest = f;
+                largestArea = area;
+            }
+        }
+
+        if (!(largestArea > 0.0f))
+            return false;
+
+        Face const& anchor = model[largest];
+        const float anchorDistance = glm::distance(faceCenter(anchor), sa.centroid);
+        const glm::mat3 anchorFrame = glm::transpose(faceFrame(anchor, 0));
+
+        std::vector<std::array<uint32_t, 3>> facesA, facesB;
+
+        for (uint32_t f: b.faces) {
+            Face const& face = model[f];
+            if (!similar(faceArea(face), largestArea, 1e-3f) ||
+                std::abs(glm::distance(faceCenter(face), sb.centroid) - anchorDistance) > tolerance + 1e-3f*anchorDistance)
+                continue;
+
+            for (int first = 0; first < 3; ++first) {
+                const glm::mat3 rotation = faceFrame(face, first)*anchorFrame;
+
+                // Cheap rejection on the anchor face alone
+                bool mapped = true;
+                for (int k = 0; k < 3 && mapped; ++k)
+                    mapped = grid.nearest(rotation*(anchor.vertex[k] - sa.centroid) + sb.centroid, tolerance) != uint32_t(-1);
+
+                for (size_t i = 0; i < a.vertices.size() && mapped; ++i) {
+                    const uint32_t v = a.vertices[i];
+                    map[v] = grid.nearest(rotation*(positions[v] - sa.centroid) + sb.centroid, tolerance);
+                    mapped = map[v] != uint32_t(-1);
+                }
+
+                if (!mapped)
+                    continue;
+
+                if (facesB.empty()) {
+                    for (uint32_t g: b.faces)
+                        facesB.push_back(canonicalFace(grid.representative(indices[3*g]),
+                                                       grid.representative(indices[3*g + 1]),
+                                                       grid.representative(indices[3*g + 2])));
+                    std::sort(facesB.begin(), facesB.end());
+                }
+
+                facesA.clear();
+                for (uint32_t g: a.faces)
+                    facesA.push_back(canonicalFace(map[indices[3*g]], map[indices[3*g + 1]], map[indices[3*g + 2]]));
+                std::sort(facesA.begin(), facesA.end());
+
+                if (facesA == facesB) {
+                    transform = glm::mat4(rotation);
+                    transform[3] = glm::vec4(sb.centroid - rotation*sa.centroid, 1.0f);
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+} /* namespace */
+
+size_t InstancedModel::faceCount() const {
+    size_t count = 0;
+    for (auto const& mesh: meshes)
+        count += mesh.model.size();
+    return count;
+}
+
+size_t InstancedModel::instancedFaceCount() const {
+    size_t count = 0;
+    for (auto const& mesh: meshes)
+        count += mesh.model.size()*mesh.instances.size();
+    return count;
+}
+
+InstancedModel rendirt::findInstances(Model const& model, float tolerance) {
+    size_t vertexCount = 0;
+    const std::vector<uint32_t> indices = weldVertices(model, vertexCount);
+
+    // Connected components by union-find over shared vertices
+    std::vector<uint32_t> parent(vertexCount);
+    std::iota(parent.begin(), parent.end(), 0);
+
+    for (size_t i = 0; i < model.size(); ++i) {
+        const uint32_t r0 = findRoot(parent, indices[3*i]);
+        parent[findRoot(parent, indices[3*i + 1])] = r0;
+        parent[findRoot(parent, indices[3*i + 2])] = r0;
+    }
+
+    std::vector<uint32_t> componentOf(vertexCount, uint32_t(-1));
+    std::vector<Component> components;
+    for (size_t i = 0; i < model.size(); ++i) {
+        uint32_t& c = componentOf[findRoot(parent, indices[3*i])];
+        if (c == uint32_t(-1)) {
+            c = uint32_t(components.size());
+            components.emplace_back();
+        }
+        components[c].faces.push_back(uint32_t(i));
+    }
+
+    std::vector<glm::vec3> positions(vertexCount);
+    for (size_t i = 0; i < model.size(); ++i)
+        for (int k = 0; k < 3; ++k)
+            positions[indices[3*i + k]] = model[i].vertex[k];
+
+    for (uint32_t v = 0; v < vertexCount; ++v)
+        components[componentOf[findRoot(parent, v)]].vertices.push_back(v);
+
+    const glm::vec3 diagonal = model.boundingBox().to - model.boundingBox().from;
+    const float absTolerance = tolerance*glm::length(diagonal);
+
+    // Unwelded vertices closer than this are taken as the same vertex
+    const float mergeDistance = std::min(absTolerance, 1e-6f*glm::length(diagonal));
+
+    struct Group {
+        uint32_t component;
+        Signature sig;
+        std::vector<glm::mat4> instances;
+    };
+
+    // Only components with equal face counts and similar area are compared:
+    // groups are bucketed by face count and sorted by area
+    std::vector<Group> groups;
+    std::unordered_map<size_t, std::multimap<float, uint32_t>> candidates;
+    std::vector<uint32_t> map(vertexCount), representative(vertexCount);
+    VertexGrid grid;
+
+    for (uint32_t c = 0; c < components.size(); ++c) {
+        const Signature sig = signature(model, components[c].faces);
+        std::multimap<float, uint32_t>& bucket = candidates[sig.faces];
+
+        auto it = bucket.lower_bound(sig.area*(1.0f - 2e-3f));
+        const auto end = bucket.upper_bound(sig.area*(1.0f + 2e-3f) + std::numeric_limits<float>::min());
+
+        glm::mat4 transform;
+        bool found = false, gridBuilt = false;
+        for (; it != end; ++it) {
+            Group& group = groups[it->second];
+            if (!similar(group.sig, sig))
+                continue;
+
+            if (!gridBuilt) {
+                grid.build(positions, components[c].vertices, sig.centroid, absTolerance, mergeDistance, representative);
+                gridBuilt = true;
+            }
+
+            if (matchRigid(model, indices, positions, components[group.component], group.sig,
+                           components[c], sig, grid, absTolerance, map, transform))
+            {
+                group.instances.push_back(transform);
+                found = true;
+                break;
+            }
+        }
 
-        brect.from = glm::max(brect.from, glm::vec3(-1.0f, -1.0f, -1.0f));
-        brect.to = glm::min(brect.to, glm::vec3(1.0f, 1.0f, 1.0f));
-        const auto dims = glm::abs(brect.to - brect.from);
+        if (!found) {
+            bucket.emplace(sig.area, uint32_t(groups.size()));
+            groups.push_back(Group{ c, sig, std::vector<glm::mat4>(1, glm::mat4(1.0f)) });
+        }
+    }
+
+    InstancedModel result;
+    Model unique;
+
+    for (auto& group: groups) {
+        std::vector<uint32_t> const& faces = components[group.component].faces;
 
-        // Discard faces outside clipping planes
-        if (dims.x <= 0.0f || dims.y <= 0.0f || brect.from.z >= 1.0f || brect.to.z <= -1.0f)
+        if (group.instances.size() == 1) {
+            for (uint32_t f: faces)
+                unique.push_back(model[f]);
             continue;
+        }
 
-        ++faceCount;
-
-        const vec2s from =
-            glm::clamp(vec2s(glm::floor((glm::vec2(brect.from.x, -brect.to.y)*0.5f + 0.5f)*imgSizef)), vec2s(0, 0), imgSize);
-        const vec2s to =
-            glm::clamp(vec2s(glm::ceil((glm::vec2(brect.to.x, -brect.from.y)*0.5f + 0.5f)*imgSizef)), vec2s(0, 0), imgSize);
-
-        // Matrix for computing barycentric coordinates normalized so their sum is 1
-        // XXX: column-major
-        const glm::mat3 barycentric = glm::mat3{
-            { clipf[1].y - clipf[2].y,                       clipf[2].y - clipf[0].y,                       clipf[0].y - clipf[1].y },
-            { clipf[2].x - clipf[1].x,                       clipf[0].x - clipf[2].x,                       clipf[1].x - clipf[0].x },
-            { clipf[1].x*clipf[2].y - clipf[1].y*clipf[2].x, clipf[2].x*clipf[0].y - clipf[2].y*clipf[0].x, clipf[0].x*clipf[1].y - clipf[0].y*clipf[1].x },
-        } / doubleArea;
-
-        const glm::vec3 posParams[3] = {
-            face.vertex[0],
-            face.vertex[1] - face.vertex[0],
-            face.vertex[2] - face.vertex[0]
-        };
-        const glm::vec3 zParams(clipf[0].z, clipf[1].z - clipf[0].z, clipf[2].z - clipf[0].z);
+        InstancedModel::Mesh mesh;
+        mesh.model.reserve(faces.size());
+        for (uint32_t f: faces)
+            mesh.model.push_back(model[f]);
+        mesh.model.updateBoundingBox();
+        mesh.instances = std::move(group.instances);
+        result.meshes.push_back(std::move(mesh));
+    }
+
+    if (!unique.empty()) {
+        unique.updateBoundingBox();
+        InstancedModel::Mesh mesh{ std::move(unique), std::vector<glm::mat4>(1, glm::mat4(1.0f)) };
+        result.meshes.push_back(std::move(mesh));
+    }
+
+    return result;
+}
 
-        const glm::vec2 sampleStart = (glm::vec2(from.x + 0.5f, from.y + 0.5f)/imgSizef - 0.5f) * glm::vec2(2.0f, -2.0f);
-        glm::vec2 sample = sampleStart;
+// Face ordering
+namespace {
+    // Triangle order produced by tipsify(), with the positions in that
+    // order where a new cluster starts because of a cache flush
+    struct TipsifyResult {
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> misses;
+        std::vector<size_t> hardBoundaries;
+    };
 
-        glm::vec3 rowLambda = barycentric * glm::vec3(sampleStart, 1.0f);
-        glm::vec3 lambda = rowLambda;
+    // Tipsify, from Sander, Nehab and Barczak, "Fast triangle reordering for
+    // vertex locality and reduced overdraw", 2007. indices holds three vertex
+    // indices per triangle. misses receives the number of vertex cache misses
+    // (for a FIFO cache of cacheSize entries) caused by each emitted triangle.
+    TipsifyResult tipsify(std::vector<uint32_t> const& indices, size_t vertexCount, size_t cacheSize) {
+        const size_t triangleCount = indices.size()/3;
+        const long k = long(cacheSize);
+
+        // Vertex to triangle adjacency, in compressed row format
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (uint32_t v: indices)
+            ++offsets[v + 1];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        std::vector<uint32_t> adjacency(indices.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = uint32_t(i/3);
+
+        std::vector<uint32_t> live(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+            live[v] = offsets[v + 1] - offsets[v];
+
+        std::vector<long> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnd, candidates;
+
+        TipsifyResult result;
+        result.order.reserve(triangleCount);
+        result.misses.reserve(triangleCount);
+
+        long time = k + 1;
+        size_t cursor = 0;
+        long fanning = vertexCount ? 0 : -1;
+
+        while (fanning >= 0) {
+            candidates.clear();
+
+            for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; ++a) {
+                const uint32_t t = adjacency[a];
+                if (emitted[t])
+                    continue;
+
+                uint32_t misses = 0;
+                for (int j = 0; j < 3; ++j) {
+                    const uint32_t v = indices[3*t + j];
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    --live[v];
+
+                    if (time - cacheTime[v] > k) {
+                        cacheTime[v] = time++;
+                        ++misses;
+                    }
+                }
 
-        const glm::vec3 rowLambdaStep = barycentric[1]*sampleStep.y;
-        const glm::vec3 lambdaStep = barycentric[0]*sampleStep.x;
+                emitted[t] = true;
+                result.order.push_back(t);
+                result.misses.push_back(misses);
+            }
 
-        for (size_t y = from.y; y < to.y; ++y, sample.y += sampleStep.y, rowLambda += rowLambdaStep) {
-            sample.x = sampleStart.x;
-            lambda = rowLambda;
+            // Next fanning vertex: the candidate that will stay in cache
+            // longest after emitting its remaining triangles
+            long next = -1, best = 0;
+            for (uint32_t v: candidates) {
+                if (live[v] == 0)
+                    continue;
 
-            for (size_t x = from.x; x < to.x; ++x, sample.x += sampleStep.x, lambda += lambdaStep) {
-                // Interpolate position and depth
-                const glm::vec3 pos = posParams[0] + lambda.y*posParams[1] + lambda.z*posParams[2];
-                const float z = zParams.x + lambda.y*zParams.y + lambda.z*zParams.z;
-
-                // Test if inside triangle, then depth test
-                if (!(std::signbit(lambda.x) | std::signbit(lambda.y) | std::signbit(lambda.z)) &&
-                    z > -1.0f && z < depth.buffer[y*depth.stride + x])
-                {
-                    depth.buffer[y*depth.stride + x] = z;
-                    color.buffer[y*color.stride + x] = shader(glm::vec3(sample, z), pos, face.normal);
+                long priority = 0;
+                if (time - cacheTime[v] + 2*long(live[v]) <= k)
+                    priority = time - cacheTime[v];
+
+                if (priority > best || next < 0) {
+                    best = priority;
+                    next = v;
+                }
+            }
+
+            if (next < 0) {
+                // Dead end: go back to recently used vertices, then scan
+                while (!deadEnd.empty() && next < 0) {
+                    const uint32_t v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (live[v] > 0)
+                        next = v;
                 }
+
+                while (next < 0 && cursor < vertexCount) {
+                    if (live[cursor] > 0)
+                        next = long(cursor);
+                    ++cursor;
+                }
+
+                if (next >= 0 && time - cacheTime[next] > k)
+                    result.hardBoundaries.push_back(result.order.size());
             }
+
+            fanning = next;
         }
+
+        return result;
     }
+} /* namespace */
 
-    return faceCount;
+// IndexedMesh methods
+IndexedMesh::IndexedMesh(Model const& model)
+    : boundingBox(model.boundingBox())
+{
+    size_t vertexCount = 0;
+    indices = weldVertices(model, vertexCount);
+
+    vertices.resize(vertexCount);
+    for (size_t i = 0; i < indices.size(); ++i)
+        vertices[indices[i]] = model[i/3].vertex[i%3];
+}
+
+void IndexedMesh::optimizeVertexCache(size_t cacheSize) {
+    const TipsifyResult tipsified = tipsify(indices, vertices.size(), std::max<size_t>(cacheSize, 3));
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    for (uint32_t f: tipsified.order)
+        sorted.insert(sorted.end(), indices.begin() + 3*f, indices.begin() + 3*f + 3);
+
+    indices.swap(sorted);
+}
+
+void rendirt::optimizeFaceOrder(Model& model, size_t cacheSize, float lambda) {
+    if (model.empty())
+        return;
+
+    size_t vertexCount = 0;
+    const std::vector<uint32_t> indices = weldVertices(model, vertexCount);
+    const TipsifyResult tipsified = tipsify(indices, vertexCount, std::max<size_t>(cacheSize, 3));
+
+    // Split the order into clusters at hard boundaries, and wherever the
+    // average cache miss ratio of the current cluster drops below lambda
+    std::vector<size_t> clusters(1, 0);
+    size_t hard = 0, misses = 0;
+
+    for (size_t i = 0; i < tipsified.order.size(); ++i) {
+        const bool hardBoundary = hard < tipsified.hardBoundaries.size() && tipsified.hardBoundaries[hard] == i;
+        hard += hardBoundary;
+
+        if (i > clusters.back() && (hardBoundary || float(misses) <= lambda*float(i - clusters.back()))) {
+            clusters.push_back(i);
+            misses = 0;
+        }
+
+        misses += tipsified.misses[i];
+    }
+
+    clusters.push_back(tipsified.order.size());
+
+    // DotSort: clusters facing away from the center of the model, on its
+    // outside, are likely to occlude the others and are drawn first
+    const glm::vec3 center = model.center();
+    std::vector<std::pair<float, size_t>> keys;
+    keys.reserve(clusters.size() - 1);
+
+    for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+
+        for (size_t i = clusters[c]; i < clusters[c + 1]; ++i) {
+            Face const& face = model[tipsified.order[i]];
+            const glm::vec3 n = glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]);
+            const float a = glm::length(n);
+
+            centroid += a*(face.vertex[0] + face.vertex[1] + face.vertex[2])/3.0f;
+            normal += n;
+            area += a;
+        }
+
+        if (area > 0.0f)
+            centroid /= area;
+
+        keys.emplace_back(-glm::dot(centroid - center, normal), c);
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](std::pair<float, size_t> const& a, std::pair<float, size_t> const& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<Face> sorted;
+    sorted.reserve(model.size());
+    for (auto const& key: keys)
+        for (size_t i = clusters[key.second]; i < clusters[key.second + 1]; ++i)
+            sorted.push_back(model[tipsified.order[i]]);
+
+    std::copy(sorted.begin(), sorted.end(), model.begin());
+}
+
+// Spatial sorting
+namespace {
+    // Runs fn(0) ... fn(threadCount - 1) concurrently, one on the calling thread
+    template<typename F>
+    void parallelFor(unsigned int threadCount, F const& fn) {
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+
+        for (unsigned int t = 1; t < threadCount; ++t)
+            threads.emplace_back(fn, t);
+
+        fn(0u);
+
+        for (auto& thread: threads)
+            thread.join();
+    }
+
+    // Spreads the low 10 bits of v so that there are two zero bits between each
+    uint32_t spreadBits(uint32_t v) {
+        v = (v*0x00010001u) & 0xff0000ffu;
+        v = (v*0x00000101u) & 0x0f00f00fu;
+        v = (v*0x00000011u) & 0xc30c30c3u;
+        v = (v*0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // Parallel least significant digit radix sort of items by their high
+    // 32 bits. Equal keys keep their relative order
+    void radixSort(std::vector<uint64_t>& items, unsigned int threadCount) {
+        static constexpr unsigned int digitBits = 8, radix = 1u << digitBits;
+
+        const size_t n = items.size();
+        const size_t chunk = (n + threadCount - 1)/threadCount;
+        std::vector<uint64_t> buffer(n);
+        std::vector<size_t> counts(threadCount*radix);
+
+        for (unsigned int shift = 32; shift < 64; shift += digitBits) {
+            std::fill(counts.begin(), counts.end(), 0);
+
+            parallelFor(threadCount, [&](unsigned int t) {
+                size_t* count = &counts[t*radix];
+                for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i)
+                    ++count[(items[i] >> shift) & (radix - 1)];
+            });
+
+            // Exclusive prefix sum, digit-major so that each thread scatters
+            // its chunk right after those of preceding threads
+            size_t total = 0;
+            bool trivial = false;
+            for (unsigned int d = 0; d < radix; ++d) {
+                size_t digitTotal = 0;
+                for (unsigned int t = 0; t < threadCount; ++t) {
+                    const size_t c = counts[t*radix + d];
+                    counts[t*radix + d] = total;
+                    total += c;
+                    digitTotal += c;
+                }
+                trivial = trivial || digitTotal == n;
+            }
+
+            // All keys share this digit: nothing to do
+            if (trivial)
+                continue;
+
+            parallelFor(threadCount, [&](unsigned int t) {
+                size_t* offset = &counts[t*radix];
+                for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i)
+                    buffer[offset[(items[i] >> shift) & (radix - 1)]++] = items[i];
+            });
+
+            items.swap(buffer);
+        }
+    }
+} /* namespace */
+
+void rendirt::sortFacesMorton(Model& model, unsigned int threadCount) {
+    static constexpr size_t minFacesPerThread = 1 << 15;
+
+    const size_t n = model.size();
+    if (n < 2)
+        return;
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, n/minFacesPerThread), 1));
+
+    const AABB& box = model.boundingBox();
+    const glm::vec3 scale = 1023.0f/glm::max(box.to - box.from, glm::vec3(std::numeric_limits<float>::min()));
+    const size_t chunk = (n + threadCount - 1)/threadCount;
+
+    // 30-bit Morton codes of face centroids in the high half, face index in the low half
+    std::vector<uint64_t> items(n);
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i) {
+            Face const& face = model[i];
+            const glm::vec3 centroid = (face.vertex[0] + face.vertex[1] + face.vertex[2])/3.0f;
+            const glm::uvec3 q(glm::clamp((centroid - box.from)*scale, glm::vec3(0.0f), glm::vec3(1023.0f)));
+
+            const uint32_t code = (spreadBits(q.x) << 2) | (spreadBits(q.y) << 1) | spreadBits(q.z);
+            items[i] = (uint64_t(code) << 32) | uint64_t(i);
+        }
+    });
+
+    radixSort(items, threadCount);
+
+    std::vector<Face> sorted(n);
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i)
+            sorted[i] = model[size_t(items[i] & 0xffffffffu)];
+    });
+
+    std::copy(sorted.begin(), sorted.end(), model.begin());
+}
+
+// Smooth normals
+PackedNormal::PackedNormal(glm::vec3 const& normal) {
+    const float norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    glm::vec2 p = (norm > 0.0f) ? glm::vec2(normal)/norm : glm::vec2(0.0f);
+    if (normal.z < 0.0f)
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x)))*glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+
+    x = int16_t(std::round(glm::clamp(p.x, -1.0f, 1.0f)*32767.0f));
+    y = int16_t(std::round(glm::clamp(p.y, -1.0f, 1.0f)*32767.0f));
+}
+
+namespace {
+    uint32_t hashCell(glm::ivec3 const& cell) {
+        return (uint32_t(cell.x)*73856093u) ^ (uint32_t(cell.y)*19349663u) ^ (uint32_t(cell.z)*83492791u);
+    }
+
+    // Open addressing table from cell hashes to runs of sorted items
+    // sharing that hash
+    class CellTable {
+    public:
+        explicit CellTable(std::vector<uint64_t> const& items) {
+            size_t runs = 0;
+            for (size_t i = 0; i < items.size(); ++i)
+                runs += (i == 0 || (items[i] >> 32) != (items[i - 1] >> 32));
+
+            size_t size = 1;
+            while (size < 2*runs)
+                size <<= 1;
+
+            mask_ = size - 1;
+            slots_.assign(size, Run{ 0, 0, 0 });
+
+            for (size_t begin = 0, end; begin < items.size(); begin = end) {
+                const uint32_t key = uint32_t(items[begin] >> 32);
+                for (end = begin + 1; end < items.size() && uint32_t(items[end] >> 32) == key; ++end)
+                    ;
+
+                size_t slot = slotOf(key);
+                while (slots_[slot].end != 0)
+                    slot = (slot + 1) & mask_;
+                slots_[slot] = Run{ key, uint32_t(begin), uint32_t(end) };
+            }
+        }
+
+        // Sets [begin, end) to the run of items with the given hash, if any
+        bool find(uint32_t key, size_t& begin, size_t& end) const {
+            for (size_t slot = slotOf(key); slots_[slot].end != 0; slot = (slot + 1) & mask_) {
+                if (slots_[slot].key == key) {
+                    begin = slots_[slot].begin;
+                    end = slots_[slot].end;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        struct Run {
+            uint32_t key, begin, end;
+        };
+
+        size_t slotOf(uint32_t key) const {
+            return size_t((uint64_t(key)*0x9e3779b97f4a7c15ull) >> 32) & mask_;
+        }
+
+        size_t mask_;
+        std::vector<Run> slots_;
+    };
+
+    // Splits sorted items into threadCount ranges of about the same size,
+    // without splitting runs of equal keys
+    std::vector<size_t> splitRuns(std::vector<uint64_t> const& items, unsigned int threadCount) {
+        const size_t n = items.size();
+        const size_t chunk = (n + threadCount - 1)/threadCount;
+        std::vector<size_t> bounds(threadCount + 1, n);
+        bounds[0] = 0;
+
+        for (unsigned int t = 1; t < threadCount; ++t) {
+            size_t i = std::max(bounds[t - 1], std::min(n, t*chunk));
+            while (i > 0 && i < n && (items[i] >> 32) == (items[i - 1] >> 32))
+                ++i;
+            bounds[t] = i;
+        }
+
+        return bounds;
+    }
+} /* namespace */
+
+IndexedMesh rendirt::smoothNormals(Model const& model, float creaseAngle, NormalWeighting weighting,
+                                   float tolerance, unsigned int threadCount)
+{
+    static constexpr size_t minCornersPerThread = 1 << 15;
+
+    IndexedMesh mesh;
+    mesh.boundingBox = model.boundingBox();
+
+    const size_t n = 3*model.size();
+    if (n == 0)
+        return mesh;
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, n/minCornersPerThread), 1));
+
+    const size_t chunk = (n + threadCount - 1)/threadCount;
+    const float maxDistance = tolerance*glm::length(mesh.boundingBox.to - mesh.boundingBox.from);
+
+    // Corner positions (adding zero turns -0 into +0) and their cells: the
+    // bit patterns of coordinates when welding only equal vertices
+    std::vector<glm::vec3> positions(n);
+    std::vector<uint64_t> items(n);
+
+    const float cellSize = 2.0f*maxDistance;
+    const auto cellOf = [cellSize](glm::vec3 const& p) {
+        if (cellSize > 0.0f)
+            return glm::ivec3(glm::floor(p/cellSize));
+
+        glm::ivec3 bits;
+        std::memcpy(&bits, &p, sizeof(bits));
+        return bits;
+    };
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t c = t*chunk, end = std::min(n, c + chunk); c < end; ++c) {
+            positions[c] = model[c/3].vertex[c%3] + glm::vec3(0.0f);
+            items[c] = (uint64_t(hashCell(cellOf(positions[c]))) << 32) | uint64_t(c);
+        }
+    });
+
+    radixSort(items, threadCount);
+
+    // Each corner is welded to the first corner within tolerance. Cells
+    // are twice as large as the tolerance, so such corners can only lie in
+    // the cell of the corner and in its neighbours on the nearer sides.
+    // Positions are gathered in sorted order, so that cells are contiguous
+    std::vector<glm::vec3> sorted(n);
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i)
+            sorted[i] = positions[size_t(items[i] & 0xffffffffu)];
+    });
+
+    std::vector<uint32_t> weld(n);
+    {
+        const CellTable cells(items);
+        const float maxDistance2 = maxDistance*maxDistance;
+
+        parallelFor(threadCount, [&](unsigned int t) {
+            for (size_t i = t*chunk, end = std::min(n, i + chunk); i < end; ++i) {
+                const glm::vec3 p = sorted[i];
+                const glm::ivec3 cell = cellOf(p);
+                glm::ivec3 side(0);
+                if (cellSize > 0.0f) {
+                    const glm::vec3 offset = p/cellSize - glm::vec3(cell);
+                    side = glm::ivec3(offset.x < 0.5f ? -1 : 1, offset.y < 0.5f ? -1 : 1, offset.z < 0.5f ? -1 : 1);
+                }
+
+                size_t first = size_t(items[i] & 0xffffffffu);
+                for (int neighbour = 0; neighbour < ((cellSize > 0.0f) ? 8 : 1); ++neighbour) {
+                    const glm::ivec3 other = cell + side*glm::ivec3(neighbour & 1, (neighbour >> 1) & 1, neighbour >> 2);
+
+                    size_t begin, runEnd;
+                    if (!cells.find(hashCell(other), begin, runEnd))
+                        continue;
+
+                    for (size_t j = begin; j < runEnd; ++j) {
+                        const glm::vec3 d = sorted[j] - p;
+                        if (glm::dot(d, d) <= maxDistance2)
+                            first = std::min(first, size_t(items[j] & 0xffffffffu));
+                    }
+                }
+
+                weld[size_t(items[i] & 0xffffffffu)] = uint32_t(first);
+            }
+        });
+    }
+
+    // Follow chains of welds, which always point to earlier corners
+    for (size_t c = 0; c < n; ++c)
+        weld[c] = weld[weld[c]];
+
+    // Group corners by welded vertex
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t c = t*chunk, end = std::min(n, c + chunk); c < end; ++c)
+            items[c] = (uint64_t(weld[c]) << 32) | uint64_t(c);
+    });
+
+    radixSort(items, threadCount);
+
+    // Unit face normals and weighted contributions of each corner
+    std::vector<glm::vec3> faceNormals(model.size()), weights(n);
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t f = t*chunk/3, end = std::min(model.size(), (t + 1)*chunk/3); f < end; ++f) {
+            Face const& face = model[f];
+            const glm::vec3 cross = glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]);
+            const float length = glm::length(cross);
+            faceNormals[f] = (length > 0.0f) ? cross/length : glm::vec3(0.0f);
+
+            for (int k = 0; k < 3; ++k) {
+                if (weighting == WeightByArea) {
+                    weights[3*f + k] = cross;
+                    continue;
+                }
+
+                const glm::vec3 e1 = face.vertex[(k + 1)%3] - face.vertex[k];
+                const glm::vec3 e2 = face.vertex[(k + 2)%3] - face.vertex[k];
+                const float l = glm::length(e1)*glm::length(e2);
+                const float angle = (l > 0.0f) ? std::acos(glm::clamp(glm::dot(e1, e2)/l, -1.0f, 1.0f)) : 0.0f;
+                weights[3*f + k] = angle*faceNormals[f];
+            }
+        }
+    });
+
+    // Normal of each corner, and index of its vertex among the distinct
+    // normals found around the same welded vertex
+    const float minCos = std::cos(creaseAngle);
+    const std::vector<size_t> bounds = splitRuns(items, threadCount);
+    std::vector<PackedNormal> normals(n);
+    std::vector<uint32_t> local(n), runSize(n);
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t begin = bounds[t], end; begin < bounds[t + 1]; begin = end) {
+            for (end = begin + 1; end < bounds[t + 1] && (items[end] >> 32) == (items[begin] >> 32); ++end)
+                ;
+
+            uint32_t distinct = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const size_t f = size_t(items[i] & 0xffffffffu)/3;
+                glm::vec3 normal(0.0f);
+
+                for (size_t j = begin; j < end; ++j) {
+                    const size_t other = size_t(items[j] & 0xffffffffu);
+                    if (glm::dot(faceNormals[f], faceNormals[other/3]) >= minCos)
+                        normal += weights[other];
+                }
+
+                if (glm::dot(normal, normal) <= 0.0f)
+                    normal = (glm::dot(faceNormals[f], faceNormals[f]) > 0.0f) ? faceNormals[f] : model[f].normal;
+
+                normals[i] = PackedNormal(glm::normalize(normal));
+
+                local[i] = distinct;
+                for (size_t j = begin; j < i; ++j) {
+                    if (normals[j] == normals[i]) {
+                        local[i] = local[j];
+                        break;
+                    }
+                }
+
+                distinct += (local[i] == distinct);
+            }
+
+            runSize[begin] = distinct;
+        }
+    });
+
+    // Exclusive prefix sum of vertex counts over runs
+    size_t vertexCount = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 0 || (items[i] >> 32) != (items[i - 1] >> 32)) {
+            const uint32_t size = runSize[i];
+            runSize[i] = uint32_t(vertexCount);
+            vertexCount += size;
+        }
+    }
+
+    mesh.vertices.resize(vertexCount);
+    mesh.normals.resize(vertexCount);
+    mesh.indices.resize(n);
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t begin = bounds[t], end; begin < bounds[t + 1]; begin = end) {
+            for (end = begin + 1; end < bounds[t + 1] && (items[end] >> 32) == (items[begin] >> 32); ++end)
+                ;
+
+            const glm::vec3 position = positions[size_t(items[begin] >> 32)];
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t vertex = runSize[begin] + local[i];
+                mesh.indices[size_t(items[i] & 0xffffffffu)] = vertex;
+                mesh.vertices[vertex] = position;
+                mesh.normals[vertex] = normals[i];
+            }
+        }
+    });
+
+    return mesh;
+}
+
+// Renderer
+namespace {
+    // The bundled glm converts mat4 to mat4x3 dropping the translation column
+    glm::mat4x3 affineColumns(glm::mat4 const& m) {
+        return glm::mat4x3(glm::vec3(m[0]), glm::vec3(m[1]), glm::vec3(m[2]), glm::vec3(m[3]));
+    }
+} /* namespace */
+
+detail::Rasterizer::Rasterizer(Image<float> const& depth, glm::mat4 const& modelViewProj)
+    : depth(depth), modelViewProj(modelViewProj),
+      affine(modelViewProj[0][3] == 0.0f && modelViewProj[1][3] == 0.0f &&
+             modelViewProj[2][3] == 0.0f && modelViewProj[3][3] != 0.0f),
+      affineTransform(affineColumns(affine ? modelViewProj/modelViewProj[3][3] : modelViewProj)),
+      imgSize(depth.width, depth.height), imgSizef(imgSize),
+      sampleStep(glm::vec2(2.0f, -2.0f)/imgSizef)
+    {}
+
+detail::BackfaceCuller::BackfaceCuller(glm::mat4 const& modelViewProj, CullingMode cullingMode)
+    : eye(glm::inverse(modelViewProj)*glm::vec4(0.0f, 0.0f, -1.0f, 0.0f)),
+      sign((glm::determinant(modelViewProj) < 0.0f) ? 1.0f : -1.0f),
+      enabled_(cullingMode != CullNone), flip(cullingMode == CullCCW)
+    {}
+
+namespace {
+    using detail::BackfaceCuller;
+    using detail::VertexCache;
+
+    // Rasterizer for Shader functions, which take an affinely interpolated
+    // position and the face normal
+    struct Rasterizer : detail::Rasterizer {
+        Rasterizer(Image<Color> const& color, Image<float> const& depth,
+                   glm::mat4 const& modelViewProj, Shader const& shader)
+            : detail::Rasterizer(depth, modelViewProj), color(color), shader(shader)
+        {
+            assert(color.width == depth.width && color.height == depth.height);
+        }
+
+        bool draw(Face const& face) const {
+            const glm::vec4 ndc[3] = {
+                transform(face.vertex[0]),
+                transform(face.vertex[1]),
+                transform(face.vertex[2])
+            };
+
+            return draw(face, ndc);
+        }
+
+        // Same as above, with vertices already transformed by transform()
+        bool draw(Face const& face, glm::vec4 const (&ndc)[3]) const {
+            const glm::vec3 posParams[3] = {
+                face.vertex[0],
+                face.vertex[1] - face.vertex[0],
+                face.vertex[2] - face.vertex[0]
+            };
+
+            return detail::Rasterizer::draw(ndc, [&](size_t x, size_t y, glm::vec3 const& frag, glm::vec3 const& lambda) {
+                const glm::vec3 pos = posParams[0] + lambda.y*posParams[1] + lambda.z*posParams[2];
+                color.buffer[y*color.stride + x] = shader(frag, pos, face.normal);
+            });
+        }
+
+        Image<Color> const& color;
+        Shader const& shader;
+    };
+
+    // Returns true if box, transformed by modelViewProj, lies entirely
+    // outside one of the clipping planes. Plain scalar loops over the eight
+    // corners; cheap next to drawing the faces inside the box
+    bool outsideFrustum(AABB const& box, glm::mat4 const& modelViewProj) {
+        float cx[8], cy[8], cz[8];
+        for (int i = 0; i < 8; ++i) {
+            cx[i] = (i & 1) ? box.to.x : box.from.x;
+            cy[i] = (i & 2) ? box.to.y : box.from.y;
+            cz[i] = (i & 4) ? box.to.z : box.from.z;
+        }
+
+        float x[8], y[8], z[8], w[8];
+        glm::mat4 const& m = modelViewProj;
+        for (int i = 0; i < 8; ++i) {
+            x[i] = m[0][0]*cx[i] + m[1][0]*cy[i] + m[2][0]*cz[i] + m[3][0];
+            y[i] = m[0][1]*cx[i] + m[1][1]*cy[i] + m[2][1]*cz[i] + m[3][1];
+            z[i] = m[0][2]*cx[i] + m[1][2]*cy[i] + m[2][2]*cz[i] + m[3][2];
+            w[i] = m[0][3]*cx[i] + m[1][3]*cy[i] + m[2][3]*cz[i] + m[3][3];
+        }
+
+        // One bit per plane, cleared as soon as a corner is inside it
+        unsigned int outside = 0x3f;
+        for (int i = 0; i < 8; ++i)
+            outside &= unsigned(x[i] < -w[i])        | (unsigned(x[i] > w[i]) << 1) |
+                       (unsigned(y[i] < -w[i]) << 2) | (unsigned(y[i] > w[i]) << 3) |
+                       (unsigned(z[i] < -w[i]) << 4) | (unsigned(z[i] > w[i]) << 5);
+
+        return outside != 0;
+    }
+
+    // Culls faces in blocks, then draws the visible ones, passing each to
+    // draw with its index
+    template<typename Fetch, typename Draw>
+    size_t cullAndDraw(size_t count, BackfaceCuller const& culler, Fetch const& fetch, Draw const& draw) {
+        static constexpr size_t BlockSize = BackfaceCuller::BlockSize;
+
+        Face block[BlockSize];
+        uint8_t visible[BlockSize];
+        size_t faceCount = 0;
+
+        for (size_t first = 0; first < count; first += BlockSize) {
+            const size_t n = std::min(BlockSize, count - first);
+            for (size_t i = 0; i < n; ++i)
+                block[i] = fetch(first + i);
+
+            if (!culler.enabled()) {
+                for (size_t i = 0; i < n; ++i)
+                    faceCount += draw(block[i], first + i);
+                continue;
+            }
+
+            for (size_t i = 0, v = culler.test(block, n, visible); i < v; ++i)
+                faceCount += draw(block[visible[i]], first + visible[i]);
+        }
+
+        return faceCount;
+    }
+
+    // Fragment callback for depth-only rendering
+    struct NoFragment {
+        void operator()(size_t, size_t, glm::vec3 const&, glm::vec3 const&) const {}
+    };
+
+    // Sort key for front to back traversal: smaller is closer to the viewer
+    float viewDistance(glm::vec4 const& eye, AABB const& box) {
+        if (eye.w == 0.0f)
+            return -glm::dot(centroid(box), glm::vec3(eye));
+
+        const glm::vec3 d = centroid(box) - glm::vec3(eye)/eye.w;
+        return glm::dot(d, d);
+    }
+} /* namespace */
+
+glm::vec4 rendirt::viewPoint(glm::mat4 const& modelViewProj) {
+    // The viewer is the point mapped to infinity along the clip space z axis
+    glm::vec4 eye = glm::inverse(modelViewProj)*glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+
+    if (std::abs(eye.w) <= 1e-7f*glm::length(glm::vec3(eye)))
+        return glm::vec4(glm::normalize(glm::vec3(eye)), 0.0f);
+
+    return eye/eye.w;
+}
+
+size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
+                       FaceView const& faces, glm::mat4 const& modelViewProj,
+                       Shader const& shader, CullingMode cullingMode)
+{
+    const Rasterizer rasterizer(color, depth, modelViewProj, shader);
+    const BackfaceCuller culler(modelViewProj, cullingMode);
+
+    return cullAndDraw(faces.size(), culler,
+        [&faces](size_t i) { return faces[i]; },
+        [&rasterizer](Face const& face, size_t) { return rasterizer.draw(face); });
+}
+
+size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
+                       IndexedMesh const& mesh, glm::mat4 const& modelViewProj,
+                       Shader const& shader, CullingMode cullingMode)
+{
+    const Rasterizer rasterizer(color, depth, modelViewProj, shader);
+    const BackfaceCuller culler(modelViewProj, cullingMode);
+    VertexCache cache;
+    size_t faceCount = 0;
+
+    for (size_t i = 0, count = mesh.indices.size(); i + 2 < count; i += 3) {
+        Face face;
+        face.vertex[0] = mesh.vertices[mesh.indices[i]];
+        face.vertex[1] = mesh.vertices[mesh.indices[i + 1]];
+        face.vertex[2] = mesh.vertices[mesh.indices[i + 2]];
+
+        if (culler.enabled() && !culler.visible(face))
+            continue;
+
+        glm::vec4 clipf[3];
+        for (int k = 0; k < 3; ++k)
+            clipf[k] = cache.fetch(mesh.indices[i + k], face.vertex[k], rasterizer);
+
+        face.normal = glm::normalize(glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]));
+        faceCount += rasterizer.draw(face, clipf);
+    }
+
+    return faceCount;
+}
+
+size_t rendirt::render(Image<float> const& depth, FaceView const& faces,
+                       glm::mat4 const& modelViewProj, CullingMode cullingMode)
+{
+    const detail::Rasterizer rasterizer(depth, modelViewProj);
+    const BackfaceCuller culler(modelViewProj, cullingMode);
+
+    return cullAndDraw(faces.size(), culler,
+        [&faces](size_t i) { return faces[i]; },
+        [&rasterizer](Face const& face, size_t) {
+            const glm::vec4 ndc[3] = {
+                rasterizer.transform(face.vertex[0]),
+                rasterizer.transform(face.vertex[1]),
+                rasterizer.transform(face.vertex[2])
+            };
+
+            return rasterizer.draw(ndc, NoFragment());
+        });
+}
+
+size_t rendirt::render(Image<float> const& depth, IndexedMesh const& mesh,
+                       glm::mat4 const& modelViewProj, CullingMode cullingMode)
+{
+    const detail::Rasterizer rasterizer(depth, modelViewProj);
+    const BackfaceCuller culler(modelViewProj, cullingMode);
+    VertexCache cache;
+    size_t faceCount = 0;
+
+    for (size_t i = 0, count = mesh.indices.size(); i + 2 < count; i += 3) {
+        uint32_t const* index = &mesh.indices[i];
+        if (culler.enabled() && !culler.visible(mesh.vertices[index[0]], mesh.vertices[index[1]], mesh.vertices[index[2]]))
+            continue;
+
+        glm::vec4 ndc[3];
+        for (int k = 0; k < 3; ++k)
+            ndc[k] = cache.fetch(index[k], mesh.vertices[index[k]], rasterizer);
+
+        faceCount += rasterizer.draw(ndc, NoFragment());
+    }
+
+    return faceCount;
+}
+
+size_t rendirt::render(Image<uint32_t> const& ids, Image<float> const& depth,
+                       FaceView const& faces, glm::mat4 const& modelViewProj,
+                       CullingMode cullingMode)
+{
+    assert(ids.width == depth.width && ids.height == depth.height);
+
+    const detail::Rasterizer rasterizer(depth, modelViewProj);
+    const BackfaceCuller culler(modelViewProj, cullingMode);
+
+    return cullAndDraw(faces.size(), culler,
+        [&faces](size_t i) { return faces[i]; },
+        [&](Face const& face, size_t i) {
+            const glm::vec4 ndc[3] = {
+                rasterizer.transform(face.vertex[0]),
+                rasterizer.transform(face.vertex[1]),
+                rasterizer.transform(face.vertex[2])
+            };
+
+            return rasterizer.draw(ndc, [&ids, i](size_t x, size_t y, glm::vec3 const&, glm::vec3 const&) {
+                ids.buffer[y*ids.stride + x] = uint32_t(i);
+            });
+        });
+}
+
+glm::mat4 rendirt::scissorMatrix(size_t x, size_t y, size_t width, size_t height,
+                                 size_t viewportWidth, size_t viewportHeight)
+{
+    // Scales and translates normalized device coordinates, so that the
+    // pixel centers of the window land on those of the target
+    const glm::vec2 scale = glm::vec2(viewportWidth, viewportHeight)/glm::vec2(width, height);
+
+    glm::mat4 m(1.0f);
+    m[0][0] = scale.x;
+    m[1][1] = scale.y;
+    m[3][0] = (float(viewportWidth) - 2.0f*float(x))/float(width) - 1.0f;
+    m[3][1] = 1.0f - (float(viewportHeight) - 2.0f*float(y))/float(height);
+    return m;
+}
+
+size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
+                       FaceView const& faces, AABB const& boundingBox,
+                       glm::mat4 const* instances, size_t instanceCount,
+                       glm::mat4 const& viewProj, Shader const& shader, CullingMode cullingMode)
+{
+    size_t faceCount = 0;
+
+    for (size_t n = 0; n < instanceCount; ++n) {
+        glm::mat4 const& model = instances[n];
+        const glm::mat4 modelViewProj = viewProj*model;
+        if (outsideFrustum(boundingBox, modelViewProj))
+            continue;
+
+        // Mirroring transforms reverse winding order
+        const glm::mat3 linear(model);
+        const bool mirrored = glm::determinant(linear) < 0.0f;
+        const CullingMode instanceCulling =
+            (mirrored && cullingMode == CullCW) ? CullCCW : (mirrored && cullingMode == CullCCW) ? CullCW : cullingMode;
+
+        // Faces are culled and transformed in model space, with a single
+        // matrix per instance. The model matrix only yields the world-space
+        // attributes passed to the shader
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(linear));
+        const glm::mat4x3 world = affineColumns(model);
+        const Rasterizer rasterizer(color, depth, modelViewProj, shader);
+        const BackfaceCuller culler(modelViewProj, instanceCulling);
+
+        faceCount += cullAndDraw(faces.size(), culler,
+            [&faces](size_t i) { return faces[i]; },
+            [&](Face const& modelFace, size_t) {
+                const glm::vec4 ndc[3] = {
+                    rasterizer.transform(modelFace.vertex[0]),
+                    rasterizer.transform(modelFace.vertex[1]),
+                    rasterizer.transform(modelFace.vertex[2])
+                };
+
+                Face face;
+                face.normal = glm::normalize(normalMatrix*modelFace.normal);
+                face.vertex[0] = world*glm::vec4(modelFace.vertex[0], 1.0f);
+                face.vertex[1] = world*glm::vec4(modelFace.vertex[1], 1.0f);
+                face.vertex[2] = world*glm::vec4(modelFace.vertex[2], 1.0f);
+                return rasterizer.draw(face, ndc);
+            });
+    }
+
+    return faceCount;
+}
+
+size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
+                       Scene const& scene, glm::mat4 const& viewProj,
+                       Shader const& shader, CullingMode cullingMode)
+{
+    assert(scene.built());
+
+    std::vector<Scene::Node> const& nodes = scene.nodes();
+    if (nodes.empty())
+        return 0;
+
+    const glm::vec4 eye = viewPoint(viewProj);
+    size_t faceCount = 0;
+
+    // Median splits keep the hierarchy balanced, so its depth is
+    // logarithmic in the number of objects
+    uint32_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        Scene::Node const& node = nodes[stack[--top]];
+        if (outsideFrustum(node.bounds, viewProj))
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                Scene::Object const& object = scene[scene.order()[i]];
+                faceCount += render(color, depth, object.faces, object.localBounds,
+                                    &object.transform, 1, viewProj, shader, cullingMode);
+            }
+        } else {
+            // Push the farther child first so that the nearer one is visited first
+            const bool swap = viewDistance(eye, nodes[node.first + 1].bounds) < viewDistance(eye, nodes[node.first].bounds);
+            stack[top++] = node.first + !swap;
+            stack[top++] = node.first + swap;
+        }
+    }
+
+    return faceCount;
+}
+
+// Visibility
+namespace {
+    // Renders face ids in orthographic views of a bounding box
+    class IdRaster {
+    public:
+        IdRaster(AABB const& boundingBox, size_t resolution)
+            : idBuffer(resolution*resolution), depthBuffer(resolution*resolution),
+              ids(idBuffer.data(), resolution, resolution),
+              depth(depthBuffer.data(), resolution, resolution),
+              center((boundingBox.from + boundingBox.to)*0.5f),
+              radius(std::max(0.5f*glm::length(boundingBox.to - boundingBox.from), 1e-6f)*1.01f),
+              proj(Projection::Orthographic, -radius, radius, -radius, radius, 0.0f, 2.0f*radius)
+            {}
+
+        // Marks faces visible from direction dir (pointing toward the viewer)
+        void markVisible(FaceView const& faces, glm::vec3 const& dir, std::vector<bool>& visible) {
+            const glm::vec3 up = (std::abs(dir.y) > 0.99f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            const glm::mat4 modelViewProj = proj*Camera(center + radius*dir, center, up);
+
+            ids.clear(RayHit::None);
+            depth.clear(1.0f);
+            render(ids, depth, faces, modelViewProj, CullNone);
+
+            for (uint32_t id: idBuffer)
+                if (id != RayHit::None)
+                    visible[id] = true;
+        }
+
+    private:
+        std::vector<uint32_t> idBuffer;
+        std::vector<float> depthBuffer;
+        Image<uint32_t> ids;
+        Image<float> depth;
+
+        const glm::vec3 center;
+        const float radius;
+        const Projection proj;
+    };
+
+    // Maps direction dir to a cube face (major axis and sign) and to
+    // coordinates u, v in [-1, 1] on that face
+    size_t cubeFace(glm::vec3 const& dir, glm::vec2& uv) {
+        const glm::vec3 a = glm::abs(dir);
+        const int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z) ? 1 : 2;
+        const float major = std::max(a[axis], std::numeric_limits<float>::min());
+
+        uv = glm::vec2(dir[(axis + 1) % 3], dir[(axis + 2) % 3])/major;
+        return size_t(2*axis + (dir[axis] < 0.0f));
+    }
+
+    glm::vec3 cubeDirection(size_t face, glm::vec2 const& uv) {
+        const int axis = int(face/2);
+        glm::vec3 dir;
+        dir[axis] = (face & 1) ? -1.0f : 1.0f;
+        dir[(axis + 1) % 3] = uv.x;
+        dir[(axis + 2) % 3] = uv.y;
+        return glm::normalize(dir);
+    }
+} /* namespace */
+
+std::vector<bool> rendirt::findVisibleFaces(FaceView const& faces, AABB const& boundingBox,
+                                            size_t directionCount, size_t resolution)
+{
+    std::vector<bool> visible(faces.size(), false);
+    if (faces.empty() || directionCount == 0 || resolution == 0)
+        return visible;
+
+    IdRaster raster(boundingBox, resolution);
+
+    // Fibonacci lattice on the unit sphere
+    const float goldenAngle = glm::pi<float>()*(3.0f - std::sqrt(5.0f));
+
+    for (size_t d = 0; d < directionCount; ++d) {
+        const float z = 1.0f - (2.0f*d + 1.0f)/float(directionCount);
+        const float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+        raster.markVisible(faces, glm::vec3(r*std::cos(goldenAngle*d), r*std::sin(goldenAngle*d), z), visible);
+    }
+
+    return visible;
+}
+
+Model rendirt::removeHiddenFaces(Model const& model, size_t directionCount, size_t resolution) {
+    const std::vector<bool> visible = findVisibleFaces(model, model.boundingBox(), directionCount, resolution);
+
+    Model result;
+    result.reserve(std::count(visible.begin(), visible.end(), true));
+    for (size_t i = 0; i < model.size(); ++i)
+        if (visible[i])
+            result.push_back(model[i]);
+
+    result.updateBoundingBox();
+    return result;
+}
+
+// VisibilitySets methods
+void VisibilitySets::build(FaceView const& faces, AABB const& boundingBox,
+                           size_t subdivisions, size_t resolution, size_t samples)
+{
+    subdivisions_ = std::max<size_t>(subdivisions, 1);
+    samples = std::max<size_t>(samples, 1);
+
+    const size_t n = subdivisions_, steps = n*samples;
+    sets_.assign(6*n*n, std::vector<uint32_t>());
+    cells_.resize(6*n*n);
+
+    // Each cell is enclosed by the cone around its center direction that
+    // reaches its farthest corner
+    for (size_t face = 0; face < 6; ++face)
+        for (size_t cy = 0; cy < n; ++cy)
+            for (size_t cx = 0; cx < n; ++cx) {
+                const glm::vec3 center = cubeDirection(face, (glm::vec2(cx, cy) + 0.5f)*2.0f/float(n) - 1.0f);
+                float angle = 0.0f;
+                for (int corner = 0; corner < 4; ++corner) {
+                    const glm::vec2 uv = glm::vec2(cx + (corner & 1), cy + (corner >> 1))*2.0f/float(n) - 1.0f;
+                    angle = std::max(angle, std::acos(glm::clamp(glm::dot(center, cubeDirection(face, uv)), -1.0f, 1.0f)));
+                }
+                cells_[face*n*n + cy*n + cx] = glm::vec4(center, angle);
+            }
+
+    // Widest angle between neighbouring samples, at the center of a face
+    spacing_ = std::atan(2.0f/float(steps));
+
+    if (faces.empty())
+        return;
+
+    IdRaster raster(boundingBox, resolution);
+    std::vector<bool> visible;
+
+    // Each bucket gathers the faces seen from a grid of samples x samples
+    // intervals over its cell, edges included. Samples on edges are shared
+    // with neighbouring cells, so they are rendered once per cube face.
+    for (size_t face = 0; face < 6; ++face) {
+        std::vector<std::vector<bool>> buckets(n*n, std::vector<bool>(faces.size(), false));
+
+        for (size_t j = 0; j <= steps; ++j) {
+            for (size_t i = 0; i <= steps; ++i) {
+                visible.assign(faces.size(), false);
+                raster.markVisible(faces, cubeDirection(face, glm::vec2(i, j)*2.0f/float(steps) - 1.0f), visible);
+
+                for (size_t cy = (j > 0) ? (j - 1)/samples : 0; cy <= std::min(j/samples, n - 1); ++cy)
+                    for (size_t cx = (i > 0) ? (i - 1)/samples : 0; cx <= std::min(i/samples, n - 1); ++cx) {
+                        std::vector<bool>& bucket = buckets[cy*n + cx];
+                        for (size_t f = 0; f < faces.size(); ++f)
+                            if (visible[f])
+                                bucket[f] = true;
+                    }
+            }
+        }
+
+        for (size_t b = 0; b < n*n; ++b) {
+            std::vector<uint32_t>& set = sets_[face*n*n + b];
+            for (size_t f = 0; f < faces.size(); ++f)
+                if (buckets[b][f])
+                    set.push_back(uint32_t(f));
+            set.shrink_to_fit();
+        }
+    }
+}
+
+size_t VisibilitySets::bucket(glm::vec3 const& direction) const {
+    glm::vec2 uv;
+    const size_t face = cubeFace(direction, uv);
+    const size_t n = subdivisions_;
+
+    const glm::vec2 cell = glm::clamp(glm::floor((uv*0.5f + 0.5f)*float(n)), glm::vec2(0.0f), glm::vec2(n - 1));
+    return face*n*n + size_t(cell.y)*n + size_t(cell.x);
+}
+
+FaceView VisibilitySets::select(FaceView const& faces, glm::mat4 const& modelViewProj, AABB const& boundingBox,
+                                std::vector<uint32_t>& selection) const
+{
+    const glm::vec4 eye = viewPoint(modelViewProj);
+
+    // Directions from points of the box toward the viewer. Under a
+    // perspective projection they fill a cone around the direction from the
+    // center, as wide as the directions from the corners
+    glm::vec3 direction = glm::vec3(eye);
+    float spread = 0.0f;
+
+    if (eye.w != 0.0f) {
+        if (glm::all(glm::greaterThanEqual(glm::vec3(eye), boundingBox.from)) &&
+            glm::all(glm::lessThanEqual(glm::vec3(eye), boundingBox.to)))
+            return faces;
+
+        direction = glm::normalize(glm::vec3(eye) - centroid(boundingBox));
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec3 p((corner & 1) ? boundingBox.to.x : boundingBox.from.x,
+                              (corner & 2) ? boundingBox.to.y : boundingBox.from.y,
+                              (corner & 4) ? boundingBox.to.z : boundingBox.from.z);
+            const glm::vec3 toEye = glm::normalize(glm::vec3(eye) - p);
+            spread = std::max(spread, std::acos(glm::clamp(glm::dot(direction, toEye), -1.0f, 1.0f)));
+        }
+
+        if (spread >= 0.5f*glm::pi<float>())
+            return faces;
+    }
+
+    // Buckets whose cells overlap the cone widened by the sample spacing,
+    // since faces seen between samples may only have been recorded by the
+    // samples of a neighbouring cell; plus some slack for rounding
+    spread += spacing_ + 1e-3f;
+
+    std::vector<size_t> buckets;
+    for (size_t b = 0; b < cells_.size(); ++b) {
+        const float angle = std::acos(glm::clamp(glm::dot(direction, glm::vec3(cells_[b])), -1.0f, 1.0f));
+        if (angle <= spread + cells_[b].w)
+            buckets.push_back(b);
+    }
+
+    if (buckets.size() == 1) {
+        std::vector<uint32_t> const& set = sets_[buckets.front()];
+        return faces.indexed(set.data(), set.size());
+    }
+
+    selection.clear();
+    for (size_t b: buckets)
+        selection.insert(selection.end(), sets_[b].begin(), sets_[b].end());
+
+    std::sort(selection.begin(), selection.end());
+    selection.erase(std::unique(selection.begin(), selection.end()), selection.end());
+    return faces.indexed(selection.data(), selection.size());
+}
+
+// ShadowMap methods
+ShadowMap::ShadowMap(glm::mat4 const& lightViewProj, size_t width, size_t height)
+    : lightViewProj_(lightViewProj), width_(width), height_(height),
+      buffer_(std::make_shared<std::vector<float>>(width*height, 1.0f))
+{
+    // World-space size of a texel, exact for parallel projections
+    texelSize_ = std::max(2.0f/(float(width)*glm::length(glm::vec3(glm::row(lightViewProj, 0)))),
+                          2.0f/(float(height)*glm::length(glm::vec3(glm::row(lightViewProj, 1)))));
+}
+
+glm::mat4 ShadowMap::directional(glm::vec3 const& direction, AABB const& boundingBox) {
+    const glm::vec3 dir = glm::normalize(direction);
+    const glm::vec3 center = centroid(boundingBox);
+    const float radius = std::max(0.5f*glm::length(boundingBox.to - boundingBox.from), 1e-6f);
+    const glm::vec3 up = (std::abs(dir.y) > 0.99f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    return Projection(Projection::Orthographic, -radius, radius, -radius, radius, radius, 3.0f*radius) *
+           Camera(center - 2.0f*radius*dir, center, up);
+}
+
+void ShadowMap::clear() {
+    std::fill(buffer_->begin(), buffer_->end(), 1.0f);
+}
+
+size_t ShadowMap::render(FaceView const& faces, glm::mat4 const& model, CullingMode cullingMode) {
+    return rendirt::render(depth(), faces, lightViewProj_*model, cullingMode);
+}
+
+float ShadowMap::visibility(glm::vec3 const& pos, glm::vec3 const& normal, int radius) const {
+    // Normal offset: surfaces at grazing angles to the light are pushed
+    // further out, by up to two texels, to get past neighbouring samples
+    const glm::vec3 depthAxis = glm::vec3(glm::row(lightViewProj_, 2));
+    const float cosine = std::min(std::abs(glm::dot(normal, depthAxis))/glm::length(depthAxis), 1.0f);
+    const float offset = texelSize_*(1.0f + std::sqrt(1.0f - cosine*cosine));
+
+    const glm::vec4 clip = lightViewProj_*glm::vec4(pos + offset*normal, 1.0f);
+    const glm::vec3 ndc = glm::vec3(clip)/clip.w;
+    if (!(std::abs(ndc.x) < 1.0f && std::abs(ndc.y) < 1.0f && ndc.z < 1.0f))
+        return 1.0f;
+
+    // One texel worth of depth along the light direction
+    const float z = ndc.z - texelSize_*glm::length(depthAxis);
+
+    const long x = long((ndc.x*0.5f + 0.5f)*float(width_));
+    const long y = long((0.5f - ndc.y*0.5f)*float(height_));
+    float const* buffer = buffer_->data();
+    int lit = 0;
+
+    for (long ty = y - radius; ty <= y + radius; ++ty) {
+        float const* row = buffer + size_t(glm::clamp(ty, 0l, long(height_) - 1))*width_;
+        for (long tx = x - radius; tx <= x + radius; ++tx)
+            lit += (z <= row[glm::clamp(tx, 0l, long(width_) - 1)]);
+    }
+
+    const int taps = (2*radius + 1)*(2*radius + 1);
+    return float(lit)/float(taps);
+}
+
+// Ambient occlusion
+namespace {
+    constexpr int aoSamples = 8;
+    constexpr int aoLevels = 5;
+    constexpr int aoBlurRadius = 2;
+    constexpr size_t aoTileSize = 32;
+    constexpr size_t minRowsPerThread = 16;
+
+    // Sample offsets in the unit disc, along a spiral. Each pixel in a 4x4
+    // block uses a different rotation, and the blur averages them back
+    struct OcclusionKernel {
+        glm::vec2 offsets[16][aoSamples];
+        float distances[aoSamples];
+
+        OcclusionKernel() {
+            static constexpr int bayer[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+
+            for (int k = 0; k < 16; ++k) {
+                for (int i = 0; i < aoSamples; ++i) {
+                    const float t = distances[i] = (float(i) + 0.5f)/float(aoSamples);
+                    const float angle = 2.0f*glm::pi<float>()*(3.0f*t + float(bayer[k])/16.0f);
+                    offsets[k][i] = t*glm::vec2(std::cos(angle), std::sin(angle));
+                }
+            }
+        }
+    };
+
+    // Of the two differences around a pixel, picks the one on the same
+    // surface (the shorter), so that normals do not bleed across edges
+    glm::vec3 slope(glm::vec4 const& prev, glm::vec4 const& center, glm::vec4 const& next) {
+        const glm::vec3 back = glm::vec3(center - prev), forward = glm::vec3(next - center);
+        if (prev.w == 0.0f)
+            return (next.w == 0.0f) ? glm::vec3(0.0f) : forward;
+        if (next.w == 0.0f)
+            return back;
+        return (glm::dot(back, back) < glm::dot(forward, forward)) ? back : forward;
+    }
+} /* namespace */
+
+void rendirt::ambientOcclusion(Image<float> const& occlusion, Image<float> const& depth,
+                               glm::mat4 const& modelViewProj, float radius, unsigned int threadCount)
+{
+    assert(occlusion.width == depth.width && occlusion.height == depth.height);
+
+    const size_t width = depth.width, height = depth.height;
+    if (width == 0 || height == 0)
+        return;
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, height/minRowsPerThread), 1));
+
+    const size_t rowsPerThread = (height + threadCount - 1)/threadCount;
+    auto rows = [&](unsigned int t, size_t& from, size_t& to) {
+        from = std::min(height, t*rowsPerThread);
+        to = std::min(height, from + rowsPerThread);
+    };
+
+    // Model-space positions of pixel centers, w = 0 on the background.
+    // Unprojection is linear along a row, up to the divide
+    std::vector<glm::vec4> positions(width*height);
+    const glm::mat4 inverse = glm::inverse(modelViewProj);
+    const glm::vec4 stepX = inverse[0]*(2.0f/float(width));
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        size_t from, to;
+        rows(t, from, to);
+
+        for (size_t y = from; y < to; ++y) {
+            float const* z = depth.buffer + y*depth.stride;
+            glm::vec4* pos = &positions[y*width];
+            glm::vec4 p = inverse[0]*(1.0f/float(width) - 1.0f) +
+                          inverse[1]*(1.0f - (2.0f*float(y) + 1.0f)/float(height)) + inverse[3];
+
+            for (size_t x = 0; x < width; ++x, p += stepX) {
+                const glm::vec4 q = p + inverse[2]*z[x];
+                pos[x] = (z[x] < 1.0f) ? glm::vec4(glm::vec3(q)/q.w, 1.0f) : glm::vec4(0.0f);
+            }
+        }
+    });
+
+    // Coarser levels keep one position out of each 2x2 block, on a rotated
+    // grid. Far samples are read from coarser levels, so that the memory
+    // touched around a pixel does not grow with the radius (McGuire et al.,
+    // Scalable Ambient Obscurance, 2012)
+    std::vector<glm::vec4> levels[aoLevels];
+    size_t levelWidth[aoLevels] = { width }, levelHeight[aoLevels] = { height };
+
+    for (int l = 1; l < aoLevels; ++l) {
+        std::vector<glm::vec4> const& finer = (l == 1) ? positions : levels[l - 1];
+        const size_t fw = levelWidth[l - 1], fh = levelHeight[l - 1];
+        const size_t w = levelWidth[l] = (fw + 1)/2, h = levelHeight[l] = (fh + 1)/2;
+        levels[l].resize(w*h);
+
+        const size_t levelRows = (h + threadCount - 1)/threadCount;
+        parallelFor(threadCount, [&](unsigned int t) {
+            for (size_t y = std::min(h, t*levelRows), end = std::min(h, y + levelRows); y < end; ++y)
+                for (size_t x = 0; x < w; ++x)
+                    levels[l][y*w + x] = finer[std::min(2*y + ((x & 1) ^ 1), fh - 1)*fw +
+                                               std::min(2*x + ((y & 1) ^ 1), fw - 1)];
+        });
+    }
+
+    // Occlusion is estimated tile by tile, so that the neighbourhoods
+    // sampled by nearby pixels stay in cache
+    static const OcclusionKernel kernel;
+    std::vector<float> raw(width*height);
+
+    const glm::vec4 eye = viewPoint(modelViewProj);
+    const glm::vec4 wRow = glm::row(modelViewProj, 3);
+    const float pixelScale = 0.5f*float(width)*glm::length(glm::vec3(glm::row(modelViewProj, 0)));
+    const float maxRadius = float(std::max(width, height))/8.0f;
+    const float radius2 = radius*radius;
+
+    const size_t tilesX = (width + aoTileSize - 1)/aoTileSize;
+    const size_t tileCount = tilesX*((height + aoTileSize - 1)/aoTileSize);
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t tile = t; tile < tileCount; tile += threadCount) {
+            const size_t x0 = (tile % tilesX)*aoTileSize, y0 = (tile / tilesX)*aoTileSize;
+            const size_t x1 = std::min(x0 + aoTileSize, width), y1 = std::min(y0 + aoTileSize, height);
+
+            for (size_t y = y0; y < y1; ++y) {
+                for (size_t x = x0; x < x1; ++x) {
+                    const size_t i = y*width + x;
+                    const glm::vec4 center = positions[i];
+                    raw[i] = 1.0f;
+
+                    if (center.w == 0.0f)
+                        continue;
+
+                    const glm::vec4 left = (x > 0) ? positions[i - 1] : glm::vec4(0.0f);
+                    const glm::vec4 right = (x + 1 < width) ? positions[i + 1] : glm::vec4(0.0f);
+                    const glm::vec4 up = (y > 0) ? positions[i - width] : glm::vec4(0.0f);
+                    const glm::vec4 down = (y + 1 < height) ? positions[i + width] : glm::vec4(0.0f);
+
+                    const glm::vec3 pos(center);
+                    glm::vec3 normal = glm::cross(slope(left, center, right), slope(up, center, down));
+                    const float length = glm::length(normal);
+                    if (!(length > 0.0f))
+                        continue;
+
+                    const glm::vec3 toEye = (eye.w != 0.0f) ? glm::vec3(eye)/eye.w - pos : glm::vec3(eye);
+                    normal *= ((glm::dot(normal, toEye) < 0.0f) ? -1.0f : 1.0f)/length;
+
+                    const float screenRadius = std::min(radius*pixelScale/glm::dot(wRow, center), maxRadius);
+                    if (!(screenRadius >= 1.0f))
+                        continue;
+
+                    glm::vec2 const* offsets = kernel.offsets[(y & 3)*4 + (x & 3)];
+                    float sum = 0.0f;
+
+                    for (int k = 0; k < aoSamples; ++k) {
+                        const glm::vec2 offset = offsets[k]*screenRadius;
+                        const long sx = long(x) + long(offset.x + std::copysign(0.5f, offset.x));
+                        const long sy = long(y) + long(offset.y + std::copysign(0.5f, offset.y));
+                        if (sx < 0 || sy < 0 || sx >= long(width) || sy >= long(height))
+                            continue;
+
+                        // Samples up to 16 pixels away come from full
+                        // resolution, then each octave one level down
+                        int level = 0;
+                        for (long d = long(kernel.distances[k]*screenRadius) >> 3; d > 1 && level + 1 < aoLevels; d >>= 1)
+                            ++level;
+
+                        std::vector<glm::vec4> const& source = (level == 0) ? positions : levels[level];
+                        const glm::vec4 sample = source[size_t(sy >> level)*levelWidth[level] + size_t(sx >> level)];
+                        const glm::vec3 v = glm::vec3(sample) - pos;
+                        const float v2 = glm::dot(v, v);
+                        if (sample.w == 0.0f || !(v2 < radius2) || !(v2 > 0.0f))
+                            continue;
+
+                        // Cosine of the elevation of the sample above the
+                        // tangent plane, fading out with distance
+                        const float cosine = glm::dot(v, normal)/std::sqrt(v2);
+                        sum += std::max(cosine - 0.1f, 0.0f)*(1.0f - v2/radius2);
+                    }
+
+                    raw[i] = std::max(1.0f - 2.0f*sum/float(aoSamples), 0.0f);
+                }
+            }
+        }
+    });
+
+    // Separable blur, ignoring neighbours too far away in model space
+    static constexpr float weights[aoBlurRadius + 1] = { 1.0f, 0.75f, 0.4f };
+    const float edge2 = 0.25f*radius2;
+    std::vector<float> horizontal(width*height);
+
+    auto blur = [&](float const* src, size_t i, size_t step, long from, long to) {
+        const glm::vec4 center = positions[i];
+        float sum = 0.0f, total = 0.0f;
+
+        for (long k = from; k <= to; ++k) {
+            const size_t j = size_t(long(i) + k*long(step));
+            const glm::vec3 d = glm::vec3(positions[j] - center);
+            const float w = weights[std::abs(k)]*positions[j].w*std::max(1.0f - glm::dot(d, d)/edge2, 0.0f);
+            sum += w*src[j];
+            total += w;
+        }
+
+        return sum/total;
+    };
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        size_t from, to;
+        rows(t, from, to);
+
+        for (size_t y = from; y < to; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                const size_t i = y*width + x;
+                horizontal[i] = (positions[i].w == 0.0f) ? 1.0f :
+                    blur(raw.data(), i, 1,
+                         -long(std::min<size_t>(x, aoBlurRadius)),
+                         long(std::min<size_t>(width - 1 - x, aoBlurRadius)));
+            }
+        }
+    });
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        size_t from, to;
+        rows(t, from, to);
+
+        for (size_t y = from; y < to; ++y) {
+            const long up = -long(std::min<size_t>(y, aoBlurRadius));
+            const long down = long(std::min<size_t>(height - 1 - y, aoBlurRadius));
+            float* out = occlusion.buffer + y*occlusion.stride;
+
+            for (size_t x = 0; x < width; ++x) {
+                const size_t i = y*width + x;
+                out[x] = (positions[i].w == 0.0f) ? 1.0f : blur(horizontal.data(), i, width, up, down);
+            }
+        }
+    });
+}
+
+void rendirt::ambientOcclusion(Image<Color> const& color, Image<float> const& depth,
+                               glm::mat4 const& modelViewProj, float radius, float strength,
+                               unsigned int threadCount)
+{
+    assert(color.width == depth.width && color.height == depth.height);
+
+    std::vector<float> buffer(depth.width*depth.height);
+    const Image<float> occlusion(buffer.data(), depth.width, depth.height);
+    ambientOcclusion(occlusion, depth, modelViewProj, radius, threadCount);
+
+    for (size_t y = 0; y < color.height; ++y) {
+        Color* row = color.buffer + y*color.stride;
+        float const* factor = &buffer[y*depth.width];
+
+        for (size_t x = 0; x < color.width; ++x) {
+            const float f = 1.0f - strength*(1.0f - factor[x]);
+            row[x] = Color(glm::clamp(glm::vec3(row[x])*f, 0.0f, 255.0f), row[x].a);
+        }
+    }
+}
+
+// BVH methods
+constexpr uint32_t RayHit::None;
+
+namespace {
+    constexpr int bvhBins = 16;
+    constexpr uint32_t bvhMaxLeafSize = 8;
+    constexpr size_t bvhStackSize = 64;
+    constexpr size_t bvhMinFacesPerThread = 4096;
+
+    float halfArea(AABB const& box) {
+        const glm::vec3 d = box.to - box.from;
+        return d.x*d.y + d.y*d.z + d.z*d.x;
+    }
+
+    void grow(AABB& box, AABB const& other) {
+        box.from = glm::min(box.from, other.from);
+        box.to = glm::max(box.to, other.to);
+    }
+
+    struct BVHBuilder {
+        std::vector<AABB> boxes;
+        std::vector<glm::vec3> centers;
+        std::vector<uint32_t> order;
+
+        // Makes nodes[node] a leaf over order[first, first + count), then
+        // partitions the range if splitting pays off. Returns the size of
+        // the first part, or 0 if the node stays a leaf
+        uint32_t split(std::vector<BVH::Node>& nodes, size_t node, uint32_t first, uint32_t count, size_t depth) {
+            AABB bounds = boxes[order[first]];
+            AABB centerBounds = { centers[order[first]], centers[order[first]] };
+
+            for (uint32_t i = first + 1; i < first + count; ++i) {
+                grow(bounds, boxes[order[i]]);
+                centerBounds.from = glm::min(centerBounds.from, centers[order[i]]);
+                centerBounds.to = glm::max(centerBounds.to, centers[order[i]]);
+            }
+
+            // Depth is bounded by the size of traversal stacks
+            nodes[node] = BVH::Node{ bounds, first, count };
+            if (count <= 2 || depth + 2 >= bvhStackSize)
+                return 0;
+
+            // Cost of each candidate split, relative to the cost of
+            // intersecting one face: one traversal step plus faces on each
+            // side weighted by the probability of hitting their bounds
+            const glm::vec3 extent = centerBounds.to - centerBounds.from;
+            float bestCost = std::numeric_limits<float>::infinity();
+            int bestAxis = -1, bestSplit = 0;
+
+            for (int axis = 0; axis < 3; ++axis) {
+                if (!(extent[axis] > 0.0f))
+                    continue;
+
+                const float scale = float(bvhBins)/extent[axis];
+                AABB binBounds[bvhBins];
+                uint32_t binCounts[bvhBins] = {};
+
+                for (uint32_t i = first; i < first + count; ++i) {
+                    const int bin = std::min(int((centers[order[i]][axis] - centerBounds.from[axis])*scale), bvhBins - 1);
+                    binBounds[bin] = binCounts[bin]++ ? AABB{ glm::min(binBounds[bin].from, boxes[order[i]].from),
+                                                              glm::max(binBounds[bin].to, boxes[order[i]].to) }
+                                                      : boxes[order[i]];
+                }
+
+                // Sweep from the right, then from the left
+                float rightArea[bvhBins];
+                uint32_t rightCount[bvhBins];
+                AABB acc = {};
+                uint32_t total = 0;
+
+                for (int b = bvhBins - 1; b > 0; --b) {
+                    if (binCounts[b])
+                        acc = total ? AABB{ glm::min(acc.from, binBounds[b].from), glm::max(acc.to, binBounds[b].to) }
+                                    : binBounds[b];
+                    total += binCounts[b];
+                    rightArea[b] = total ? halfArea(acc) : 0.0f;
+                    rightCount[b] = total;
+                }
+
+                total = 0;
+                for (int b = 0; b < bvhBins - 1; ++b) {
+                    if (binCounts[b])
+                        acc = total ? AABB{ glm::min(acc.from, binBounds[b].from), glm::max(acc.to, binBounds[b].to) }
+                                    : binBounds[b];
+                    total += binCounts[b];
+
+                    const float cost = float(total)*halfArea(acc) + float(rightCount[b + 1])*rightArea[b + 1];
+                    if (total && rightCount[b + 1] && cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+
+            if (bestAxis < 0) {
+                // All centroids coincide: split by count
+                return (count <= bvhMaxLeafSize) ? 0 : count/2;
+            }
+
+            bestCost = 1.0f + bestCost/halfArea(bounds);
+            if (count <= bvhMaxLeafSize && bestCost >= float(count))
+                return 0;
+
+            const float from = centerBounds.from[bestAxis];
+            const float scale = float(bvhBins)/extent[bestAxis];
+            const int axis = bestAxis, bin = bestSplit;
+
+            return uint32_t(std::partition(order.begin() + first, order.begin() + first + count,
+                [this, axis, from, scale, bin](uint32_t i) {
+                    return std::min(int((centers[i][axis] - from)*scale), bvhBins - 1) < bin;
+                }) - (order.begin() + first));
+        }
+
+        void buildNode(std::vector<BVH::Node>& nodes, size_t node, uint32_t first, uint32_t count, size_t depth) {
+            const uint32_t half = split(nodes, node, first, count, depth);
+            if (half == 0)
+                return;
+
+            const uint32_t child = uint32_t(nodes.size());
+            nodes.resize(nodes.size() + 2);
+            nodes[node].first = child;
+            nodes[node].count = 0;
+
+            buildNode(nodes, child, first, half, depth + 1);
+            buildNode(nodes, child + 1, first + half, count - half, depth + 1);
+        }
+    };
+
+    // Returns the distance at which ray enters box, or infinity if it
+    // misses it or enters past maxDistance
+    inline float entry(AABB const& box, glm::vec3 const& origin, glm::vec3 const& inverse, float maxDistance) {
+        const glm::vec3 t0 = (box.from - origin)*inverse;
+        const glm::vec3 t1 = (box.to - origin)*inverse;
+        const glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+
+        const float tNear = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        const float tFar = std::min(std::min(far.x, far.y), std::min(far.z, maxDistance));
+        return (tNear <= tFar) ? tNear : std::numeric_limits<float>::infinity();
+    }
+} /* namespace */
+
+void BVH::build(FaceView const& faces, unsigned int threadCount) {
+    clear();
+
+    const size_t n = faces.size();
+    if (n == 0)
+        return;
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, n/bvhMinFacesPerThread), 1));
+
+    BVHBuilder builder;
+    builder.boxes.resize(n);
+    builder.centers.resize(n);
+    builder.order.resize(n);
+
+    const size_t chunk = (n + threadCount - 1)/threadCount;
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t i = t*chunk, end = std::min(n, (t + 1)*chunk); i < end; ++i) {
+            const Face face = faces[i];
+            builder.boxes[i] = AABB{ glm::min(face.vertex[0], glm::min(face.vertex[1], face.vertex[2])),
+                                     glm::max(face.vertex[0], glm::max(face.vertex[1], face.vertex[2])) };
+            builder.centers[i] = centroid(builder.boxes[i]);
+            builder.order[i] = uint32_t(i);
+        }
+    });
+
+    // Top levels are split serially until there are enough subtrees to
+    // keep all threads busy; subtrees are then built in parallel, each in
+    // its own node array, and appended to the hierarchy
+    struct Task {
+        uint32_t node, first, count, depth;
+    };
+
+    std::vector<Task> tasks;
+    nodes_.reserve(2*n);
+    nodes_.emplace_back();
+    tasks.push_back(Task{ 0, 0, uint32_t(n), 0 });
+
+    auto larger = [](Task const& a, Task const& b) { return a.count < b.count; };
+    std::vector<Task> pending;
+
+    while (threadCount > 1 && !tasks.empty() && tasks.size() + pending.size() < 4*threadCount) {
+        std::pop_heap(tasks.begin(), tasks.end(), larger);
+        const Task task = tasks.back();
+        tasks.pop_back();
+
+        if (task.count < bvhMinFacesPerThread) {
+            pending.push_back(task);
+            continue;
+        }
+
+        const uint32_t half = builder.split(nodes_, task.node, task.first, task.count, task.depth);
+        if (half == 0)
+            continue;
+
+        const uint32_t child = uint32_t(nodes_.size());
+        nodes_.resize(nodes_.size() + 2);
+        nodes_[task.node].first = child;
+        nodes_[task.node].count = 0;
+
+        tasks.push_back(Task{ child, task.first, half, task.depth + 1 });
+        std::push_heap(tasks.begin(), tasks.end(), larger);
+        tasks.push_back(Task{ child + 1, task.first + half, task.count - half, task.depth + 1 });
+        std::push_heap(tasks.begin(), tasks.end(), larger);
+    }
+
+    tasks.insert(tasks.end(), pending.begin(), pending.end());
+    std::sort(tasks.begin(), tasks.end(), [](Task const& a, Task const& b) { return a.count > b.count; });
+
+    std::vector<std::vector<Node>> subtrees(tasks.size());
+    std::atomic<size_t> next(0);
+
+    parallelFor(threadCount, [&](unsigned int) {
+        for (size_t i; (i = next++) < tasks.size();) {
+            subtrees[i].reserve(2*tasks[i].count);
+            subtrees[i].emplace_back();
+            builder.buildNode(subtrees[i], 0, tasks[i].first, tasks[i].count, tasks[i].depth);
+        }
+    });
+
+    // The root of each subtree replaces its task node, other nodes are
+    // appended with their child indices shifted accordingly
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const uint32_t offset = uint32_t(nodes_.size()) - 1;
+        for (Node& node: subtrees[i])
+            node.first += (node.count == 0) ? offset : 0;
+
+        nodes_[tasks[i].node] = subtrees[i].front();
+        nodes_.insert(nodes_.end(), subtrees[i].begin() + 1, subtrees[i].end());
+        std::vector<Node>().swap(subtrees[i]);
+    }
+
+    triangles_.resize(n);
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t i = t*chunk, end = std::min(n, (t + 1)*chunk); i < end; ++i) {
+            const Face face = faces[builder.order[i]];
+            triangles_[i] = Triangle{ face.vertex[0], face.vertex[1] - face.vertex[0],
+                                      face.vertex[2] - face.vertex[0], builder.order[i] };
+        }
+    });
+}
+
+bool BVH::occluded(Ray const& ray, float maxDistance) const {
+    if (nodes_.empty())
+        return false;
+
+    const glm::vec3 inverse = 1.0f/ray.direction;
+    uint32_t stack[bvhStackSize];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        Node const& node = nodes_[stack[--top]];
+        if (entry(node.bounds, ray.origin, inverse, maxDistance) == std::numeric_limits<float>::infinity())
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.first, end = node.first + node.count; i < end; ++i) {
+            Triangle const& tri = triangles_[i];
+            const glm::vec3 p = glm::cross(ray.direction, tri.edge2);
+            const float det = glm::dot(tri.edge1, p);
+            if (det == 0.0f)
+                continue;
+
+            const float inv = 1.0f/det;
+            const glm::vec3 s = ray.origin - tri.vertex;
+            const float u = glm::dot(s, p)*inv;
+            if (u < 0.0f || u > 1.0f)
+                continue;
+
+            const glm::vec3 q = glm::cross(s, tri.edge1);
+            const float v = glm::dot(ray.direction, q)*inv;
+            const float t = glm::dot(tri.edge2, q)*inv;
+            if (v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < maxDistance)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned int BVH::occluded(Ray const (&rays)[4], float maxDistance) const {
+    return occludedPacket(rays, maxDistance);
+}
+
+unsigned int BVH::occluded(Ray const (&rays)[8], float maxDistance) const {
+    return occludedPacket(rays, maxDistance);
+}
+
+// Rays are stored by component (structure of arrays), and every test is a
+// loop over the packet without early exits, which compilers vectorize
+template<size_t N>
+unsigned int BVH::occludedPacket(Ray const (&rays)[N], float maxDistance) const {
+    if (nodes_.empty())
+        return 0;
+
+    float ox[N], oy[N], oz[N], dx[N], dy[N], dz[N], ix[N], iy[N], iz[N];
+    int active[N];
+
+    for (size_t k = 0; k < N; ++k) {
+        ox[k] = rays[k].origin.x; oy[k] = rays[k].origin.y; oz[k] = rays[k].origin.z;
+        dx[k] = rays[k].direction.x; dy[k] = rays[k].direction.y; dz[k] = rays[k].direction.z;
+        ix[k] = 1.0f/dx[k]; iy[k] = 1.0f/dy[k]; iz[k] = 1.0f/dz[k];
+        active[k] = 1;
+    }
+
+    uint32_t stack[bvhStackSize];
+    size_t top = 0;
+    stack[top++] = 0;
+    size_t remaining = N;
+
+    while (top > 0) {
+        Node const& node = nodes_[stack[--top]];
+
+        int any = 0;
+        for (size_t k = 0; k < N; ++k) {
+            const float x0 = (node.bounds.from.x - ox[k])*ix[k], x1 = (node.bounds.to.x - ox[k])*ix[k];
+            const float y0 = (node.bounds.from.y - oy[k])*iy[k], y1 = (node.bounds.to.y - oy[k])*iy[k];
+            const float z0 = (node.bounds.from.z - oz[k])*iz[k], z1 = (node.bounds.to.z - oz[k])*iz[k];
+
+            const float tNear = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+            const float tFar = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), maxDistance));
+            any |= active[k] & int(tNear <= tFar);
+        }
+
+        if (!any)
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.first, end = node.first + node.count; i < end; ++i) {
+            Triangle const& tri = triangles_[i];
+
+            for (size_t k = 0; k < N; ++k) {
+                // p = d x e2, s = o - v, q = s x e1
+                const float px = dy[k]*tri.edge2.z - dz[k]*tri.edge2.y;
+                const float py = dz[k]*tri.edge2.x - dx[k]*tri.edge2.z;
+                const float pz = dx[k]*tri.edge2.y - dy[k]*tri.edge2.x;
+                const float det = tri.edge1.x*px + tri.edge1.y*py + tri.edge1.z*pz;
+                const float inv = 1.0f/det;
+
+                const float sx = ox[k] - tri.vertex.x, sy = oy[k] - tri.vertex.y, sz = oz[k] - tri.vertex.z;
+                const float u = (sx*px + sy*py + sz*pz)*inv;
+
+                const float qx = sy*tri.edge1.z - sz*tri.edge1.y;
+                const float qy = sz*tri.edge1.x - sx*tri.edge1.z;
+                const float qz = sx*tri.edge1.y - sy*tri.edge1.x;
+                const float v = (dx[k]*qx + dy[k]*qy + dz[k]*qz)*inv;
+                const float t = (tri.edge2.x*qx + tri.edge2.y*qy + tri.edge2.z*qz)*inv;
+
+                // Comparisons with NaN fail for degenerate faces
+                const int hit = int(u >= 0.0f) & int(v >= 0.0f) & int(u + v <= 1.0f) & int(t > 0.0f) & int(t < maxDistance);
+                active[k] &= hit ^ 1;
+            }
+        }
+
+        remaining = 0;
+        for (size_t k = 0; k < N; ++k)
+            remaining += active[k];
+
+        if (remaining == 0)
+            break;
+    }
+
+    unsigned int mask = 0;
+    for (size_t k = 0; k < N; ++k)
+        mask |= unsigned(!active[k]) << k;
+
+    return mask;
+}
+
+namespace {
+    // Sign of the Moller-Trumbore determinant for faces that are kept:
+    // positive when the face is seen counter-clockwise from the ray origin
+    float facing(CullingMode cullingMode) {
+        return cullingMode == CullCW ? 1.0f : cullingMode == CullCCW ? -1.0f : 0.0f;
+    }
+} /* namespace */
+
+RayHit BVH::intersect(Ray const& ray, float maxDistance, CullingMode cullingMode) const {
+    const float sign = facing(cullingMode);
+    RayHit hit = { RayHit::None, maxDistance, glm::vec2(0.0f) };
+    if (nodes_.empty())
+        return hit;
+
+    const glm::vec3 inverse = 1.0f/ray.direction;
+    uint32_t stack[bvhStackSize];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        Node const& node = nodes_[stack[--top]];
+        if (entry(node.bounds, ray.origin, inverse, hit.distance) == std::numeric_limits<float>::infinity())
+            continue;
+
+        // Nearer child first, so that farther ones are pruned by distance
+        if (node.count == 0) {
+            const bool swap = glm::dot(centroid(nodes_[node.first + 1].bounds) - centroid(nodes_[node.first].bounds),
+                                       ray.direction) < 0.0f;
+            stack[top++] = node.first + !swap;
+            stack[top++] = node.first + swap;
+            continue;
+        }
+
+        for (uint32_t i = node.first, end = node.first + node.count; i < end; ++i) {
+            Triangle const& tri = triangles_[i];
+            const glm::vec3 p = glm::cross(ray.direction, tri.edge2);
+            const float det = glm::dot(tri.edge1, p);
+            if (det == 0.0f || det*sign < 0.0f)
+                continue;
+
+            const float inv = 1.0f/det;
+            const glm::vec3 s = ray.origin - tri.vertex;
+            const float u = glm::dot(s, p)*inv;
+            if (u < 0.0f || u > 1.0f)
+                continue;
+
+            const glm::vec3 q = glm::cross(s, tri.edge1);
+            const float v = glm::dot(ray.direction, q)*inv;
+            const float t = glm::dot(tri.edge2, q)*inv;
+            if (v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < hit.distance)
+                hit = RayHit{ i, t, glm::vec2(u, v) };
+        }
+    }
+
+    if (hit)
+        hit.face = triangles_[hit.face].face;
+
+    return hit;
+}
+
+void BVH::intersect(Ray const (&rays)[4], RayHit (&hits)[4], float maxDistance, CullingMode cullingMode) const {
+    intersectPacket(rays, hits, maxDistance, cullingMode);
+}
+
+void BVH::intersect(Ray const (&rays)[8], RayHit (&hits)[8], float maxDistance, CullingMode cullingMode) const {
+    intersectPacket(rays, hits, maxDistance, cullingMode);
+}
+
+// Same layout as occludedPacket. Every lane keeps its closest hit so far,
+// updated by selects rather than branches
+template<size_t N>
+void BVH::intersectPacket(Ray const (&rays)[N], RayHit (&hits)[N], float maxDistance, CullingMode cullingMode) const {
+    const float sign = facing(cullingMode);
+    float ox[N], oy[N], oz[N], dx[N], dy[N], dz[N], ix[N], iy[N], iz[N];
+    float best[N], bestU[N], bestV[N];
+    uint32_t bestFace[N];
+
+    glm::vec3 direction(0.0f);
+    for (size_t k = 0; k < N; ++k) {
+        ox[k] = rays[k].origin.x; oy[k] = rays[k].origin.y; oz[k] = rays[k].origin.z;
+        dx[k] = rays[k].direction.x; dy[k] = rays[k].direction.y; dz[k] = rays[k].direction.z;
+        ix[k] = 1.0f/dx[k]; iy[k] = 1.0f/dy[k]; iz[k] = 1.0f/dz[k];
+        best[k] = maxDistance; bestU[k] = bestV[k] = 0.0f;
+        bestFace[k] = RayHit::None;
+        direction += rays[k].direction;
+    }
+
+    uint32_t stack[bvhStackSize];
+    size_t top = 0;
+    if (!nodes_.empty())
+        stack[top++] = 0;
+
+    while (top > 0) {
+        Node const& node = nodes_[stack[--top]];
+
+        int any = 0;
+        for (size_t k = 0; k < N; ++k) {
+            const float x0 = (node.bounds.from.x - ox[k])*ix[k], x1 = (node.bounds.to.x - ox[k])*ix[k];
+            const float y0 = (node.bounds.from.y - oy[k])*iy[k], y1 = (node.bounds.to.y - oy[k])*iy[k];
+            const float z0 = (node.bounds.from.z - oz[k])*iz[k], z1 = (node.bounds.to.z - oz[k])*iz[k];
+
+            const float tNear = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+            const float tFar = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), best[k]));
+            any |= int(tNear <= tFar);
+        }
+
+        if (!any)
+            continue;
+
+        if (node.count == 0) {
+            const bool swap = glm::dot(centroid(nodes_[node.first + 1].bounds) - centroid(nodes_[node.first].bounds),
+                                       direction) < 0.0f;
+            stack[top++] = node.first + !swap;
+            stack[top++] = node.first + swap;
+            continue;
+        }
+
+        for (uint32_t i = node.first, end = node.first + node.count; i < end; ++i) {
+            Triangle const& tri = triangles_[i];
+
+            for (size_t k = 0; k < N; ++k) {
+                const float px = dy[k]*tri.edge2.z - dz[k]*tri.edge2.y;
+                const float py = dz[k]*tri.edge2.x - dx[k]*tri.edge2.z;
+                const float pz = dx[k]*tri.edge2.y - dy[k]*tri.edge2.x;
+                const float det = tri.edge1.x*px + tri.edge1.y*py + tri.edge1.z*pz;
+                const float inv = 1.0f/det;
+
+                const float sx = ox[k] - tri.vertex.x, sy = oy[k] - tri.vertex.y, sz = oz[k] - tri.vertex.z;
+                const float u = (sx*px + sy*py + sz*pz)*inv;
+
+                const float qx = sy*tri.edge1.z - sz*tri.edge1.y;
+                const float qy = sz*tri.edge1.x - sx*tri.edge1.z;
+                const float qz = sx*tri.edge1.y - sy*tri.edge1.x;
+                const float v = (dx[k]*qx + dy[k]*qy + dz[k]*qz)*inv;
+                const float t = (tri.edge2.x*qx + tri.edge2.y*qy + tri.edge2.z*qz)*inv;
+
+                const int hit = int(u >= 0.0f) & int(v >= 0.0f) & int(u + v <= 1.0f) & int(t > 0.0f) & int(t < best[k]) &
+                                int(det*sign >= 0.0f);
+                best[k] = hit ? t : best[k];
+                bestU[k] = hit ? u : bestU[k];
+                bestV[k] = hit ? v : bestV[k];
+                bestFace[k] = hit ? i : bestFace[k];
+            }
+        }
+    }
+
+    for (size_t k = 0; k < N; ++k) {
+        const bool hit = bestFace[k] != RayHit::None;
+        hits[k] = RayHit{ hit ? triangles_[bestFace[k]].face : RayHit::None,
+                          best[k], glm::vec2(bestU[k], bestV[k]) };
+    }
+}
+
+// Occlusion baking
+namespace {
+    constexpr size_t minVerticesPerThread = 256;
+
+    // Orthonormal basis around unit vector n (Duff et al., 2017)
+    void basis(glm::vec3 const& n, glm::vec3& t, glm::vec3& b) {
+        const float sign = std::copysign(1.0f, n.z);
+        const float a = -1.0f/(sign + n.z);
+        const float c = n.x*n.y*a;
+        t = glm::vec3(1.0f + sign*n.x*n.x*a, sign*c, -sign*n.x);
+        b = glm::vec3(c, sign + n.y*n.y*a, -n.y);
+    }
+} /* namespace */
+
+void rendirt::bakeOcclusion(IndexedMesh& mesh, BVH const& bvh, float distance,
+                            size_t samples, unsigned int threadCount)
+{
+    const size_t n = mesh.vertices.size();
+    mesh.occlusion.assign(n, 1.0f);
+    if (n == 0 || bvh.size() == 0)
+        return;
+
+    std::vector<glm::vec3> normals(n, glm::vec3(0.0f));
+    if (mesh.normals.size() == n) {
+        for (size_t i = 0; i < n; ++i)
+            normals[i] = mesh.normals[i].unpack();
+    } else {
+        // Area-weighted face normals
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            uint32_t const* index = &mesh.indices[i];
+            const glm::vec3 normal = glm::cross(mesh.vertices[index[1]] - mesh.vertices[index[0]],
+                                                mesh.vertices[index[2]] - mesh.vertices[index[0]]);
+            for (int k = 0; k < 3; ++k)
+                normals[index[k]] += normal;
+        }
+    }
+
+    // Cosine-weighted directions from a Hammersley set, rotated around the
+    // normal by a different angle at each vertex
+    const size_t packets = std::max<size_t>((samples + 7)/8, 1);
+    std::vector<glm::vec3> directions(8*packets);
+
+    for (size_t i = 0; i < directions.size(); ++i) {
+        uint32_t bits = uint32_t(i);
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+        bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+        bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+
+        const float u = (float(i) + 0.5f)/float(directions.size());
+        const float angle = 2.0f*glm::pi<float>()*float(bits)*2.3283064e-10f;
+        const float r = std::sqrt(u);
+        directions[i] = glm::vec3(r*std::cos(angle), r*std::sin(angle), std::sqrt(std::max(1.0f - u, 0.0f)));
+    }
+
+    // Rays start slightly off the surface to avoid hitting the faces
+    // around their own vertex
+    const AABB box = bvh.boundingBox();
+    const float offset = 1e-4f*glm::length(box.to - box.from);
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, n/minVerticesPerThread), 1));
+
+    const size_t chunk = (n + threadCount - 1)/threadCount;
+
+    parallelFor(threadCount, [&](unsigned int t) {
+        for (size_t v = t*chunk, end = std::min(n, (t + 1)*chunk); v < end; ++v) {
+            const float length = glm::length(normals[v]);
+            if (!(length > 0.0f))
+                continue;
+
+            const glm::vec3 normal = normals[v]/length;
+            glm::vec3 tangent, bitangent;
+            basis(normal, tangent, bitangent);
+
+            const float angle = 2.0f*glm::pi<float>()*float(uint32_t(v)*2654435761u)*2.3283064e-10f;
+            const float c = std::cos(angle), s = std::sin(angle);
+            const glm::vec3 tx = c*tangent + s*bitangent, ty = c*bitangent - s*tangent;
+
+            Ray rays[8];
+            size_t hits = 0;
+
+            for (size_t p = 0; p < packets; ++p) {
+                for (size_t k = 0; k < 8; ++k) {
+                    const glm::vec3 d = directions[8*p + k];
+                    rays[k].origin = mesh.vertices[v] + offset*normal;
+                    rays[k].direction = d.x*tx + d.y*ty + d.z*normal;
+                }
+
+                const unsigned int mask = bvh.occluded(rays, distance);
+                for (size_t k = 0; k < 8; ++k)
+                    hits += (mask >> k) & 1u;
+            }
+
+            mesh.occlusion[v] = 1.0f - float(hits)/float(8*packets);
+        }
+    });
+}
+
+// Ray casting
+namespace {
+    constexpr size_t rayMinRowsPerThread = 8;
+    constexpr size_t rayPacketSize = 8;
+
+    // Casts one ray per pixel center of depth through bvh, from the near
+    // plane (distance 0) to the far plane (distance 1), and updates depth
+    // as the rasterizer does. For each hit that passes the depth test,
+    // shade(x, y, frag, ray, hit) is called. Returns number of pixels shaded
+    template<typename Shade>
+    size_t castPixels(Image<float> const& depth, BVH const& bvh, glm::mat4 const& modelViewProj,
+                      CullingMode cullingMode, unsigned int threadCount, Shade const& shade)
+    {
+        const size_t width = depth.width, height = depth.height;
+        if (width == 0 || height == 0 || bvh.size() == 0)
+            return 0;
+
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        threadCount = unsigned(std::max<size_t>(std::min<size_t>(threadCount, height/rayMinRowsPerThread), 1));
+
+        // Rays are cast in model space: the winding seen on screen matches the
+        // one seen from the viewer when det(modelViewProj) < 0, as with the
+        // usual projections, and is reversed otherwise (see BackfaceCuller)
+        if (!(glm::determinant(modelViewProj) < 0.0f) && cullingMode != CullNone)
+            cullingMode = (cullingMode == CullCW) ? CullCCW : CullCW;
+
+        const glm::mat4 inverse = glm::inverse(modelViewProj);
+        const glm::vec2 sampleStep = glm::vec2(2.0f, -2.0f)/glm::vec2(width, height);
+
+        auto unproject = [&inverse](glm::vec2 const& ndc, float z) {
+            const glm::vec4 p = inverse[0]*ndc.x + inverse[1]*ndc.y + inverse[2]*z + inverse[3];
+            return glm::vec3(p)/p.w;
+        };
+
+        // Rows are interleaved between threads, which balances empty borders
+        std::vector<size_t> counts(threadCount, 0);
+
+        parallelFor(threadCount, [&](unsigned int t) {
+            Ray rays[rayPacketSize];
+            RayHit hits[rayPacketSize];
+            glm::vec2 ndc[rayPacketSize];
+            size_t count = 0;
+
+            for (size_t y = t; y < height; y += threadCount) {
+                float* row = depth.buffer + y*depth.stride;
+
+                for (size_t x0 = 0; x0 < width; x0 += rayPacketSize) {
+                    const size_t n = std::min(rayPacketSize, width - x0);
+
+                    // Rays stop at the current depth. Short packets repeat their
+                    // last ray, whose copies are ignored
+                    float maxDistance = 0.0f;
+                    for (size_t k = 0; k < rayPacketSize; ++k) {
+                        const size_t x = x0 + std::min(k, n - 1);
+                        ndc[k] = glm::vec2(-1.0f, 1.0f) + (glm::vec2(x, y) + 0.5f)*sampleStep;
+                        rays[k].origin = unproject(ndc[k], -1.0f);
+                        rays[k].direction = unproject(ndc[k], 1.0f) - rays[k].origin;
+
+                        float limit = 1.0f;
+                        if (row[x] < 1.0f)
+                            limit = glm::dot(unproject(ndc[k], row[x]) - rays[k].origin, rays[k].direction) /
+                                    glm::dot(rays[k].direction, rays[k].direction);
+                        maxDistance = std::max(maxDistance, limit);
+                    }
+
+                    if (!(maxDistance > 0.0f))
+                        continue;
+
+                    bvh.intersect(rays, hits, maxDistance, cullingMode);
+
+                    for (size_t k = 0; k < n; ++k) {
+                        if (!hits[k])
+                            continue;
+
+                        const glm::vec3 point = rays[k].origin + hits[k].distance*rays[k].direction;
+                        const glm::vec4 clip = modelViewProj*glm::vec4(point, 1.0f);
+                        const float z = clip.z/clip.w;
+
+                        if (z > -1.0f && z < row[x0 + k]) {
+                            row[x0 + k] = z;
+                            shade(x0 + k, y, glm::vec3(ndc[k], z), rays[k], hits[k]);
+                            ++count;
+                        }
+                    }
+                }
+            }
+
+            counts[t] = count;
+        });
+
+        return std::accumulate(counts.begin(), counts.end(), size_t(0));
+    }
+} /* namespace */
+
+size_t rendirt::render(Image<Color> const& color, Image<float> const& depth,
+                       FaceView const& faces, BVH const& bvh, glm::mat4 const& modelViewProj,
+                       Shader const& shader, CullingMode cullingMode, unsigned int threadCount)
+{
+    assert(color.width == depth.width && color.height == depth.height);
+
+    const glm::vec4 wRow = glm::row(modelViewProj, 3);
+
+    return castPixels(depth, bvh, modelViewProj, cullingMode, threadCount,
+        [&](size_t x, size_t y, glm::vec3 const& frag, Ray const&, RayHit const& hit) {
+            // The rasterizer interpolates positions with screen-space weights:
+            // perspective-correct weights scaled by the clip w of each vertex
+            Face const face = faces[hit.face];
+            glm::vec3 lambda = glm::vec3(1.0f - hit.barycentric.x - hit.barycentric.y, hit.barycentric) *
+                glm::vec3(glm::dot(wRow, glm::vec4(face.vertex[0], 1.0f)),
+                          glm::dot(wRow, glm::vec4(face.vertex[1], 1.0f)),
+                          glm::dot(wRow, glm::vec4(face.vertex[2], 1.0f)));
+            lambda /= lambda.x + lambda.y + lambda.z;
+
+            const glm::vec3 pos = face.vertex[0] + lambda.y*(face.vertex[1] - face.vertex[0]) +
+                                  lambda.z*(face.vertex[2] - face.vertex[0]);
+
+            color.buffer[y*color.stride + x] = shader(frag, pos, face.normal);
+        });
+}
+
+size_t rendirt::render(Image<uint32_t> const& ids, Image<float> const& depth,
+                       BVH const& bvh, glm::mat4 const& modelViewProj,
+                       CullingMode cullingMode, unsigned int threadCount)
+{
+    assert(ids.width == depth.width && ids.height == depth.height);
+
+    return castPixels(depth, bvh, modelViewProj, cullingMode, threadCount,
+        [&ids](size_t x, size_t y, glm::vec3 const&, Ray const&, RayHit const& hit) {
+            ids.buffer[y*ids.stride + x] = hit.face;
+        });
+}
+
+bool rendirt::preferRayCasting(size_t faceCount, size_t width, size_t height, bool hasBVH,
+                               RenderCosts const& costs)
+{
+    // Rasterization goes through every face, then fills pixels; a ray
+    // traverses about log2(faceCount) levels of the hierarchy
+    const double faces = double(faceCount), pixels = double(width)*double(height);
+    const double raster = costs.face*faces + costs.pixel*pixels;
+    const double cast = (costs.ray + costs.rayLevel*std::log2(faces + 1.0))*pixels +
+                        (hasBVH ? 0.0 : costs.buildFace*faces);
+
+    return cast < raster;
+}
+
+// Shaders
+namespace {
+    // Inverse of the octahedral mapping, for p in [-1, 1]^2
+    glm::vec3 octahedralDirection(glm::vec2 p) {
+        const float z = 1.0f - std::abs(p.x) - std::abs(p.y);
+        if (z < 0.0f)
+            p = (1.0f - glm::abs(glm::vec2(p.y, p.x)))*glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+        return glm::normalize(glm::vec3(p, z));
+    }
+
+    // Bilinear filtering with clamp to edge, at texture coordinates uv in [0, 1]^2
+    glm::vec4 sample(Image<Color> const& texture, glm::vec2 const& uv) {
+        const glm::vec2 pos = glm::clamp(uv*glm::vec2(texture.width, texture.height) - 0.5f,
+                                         glm::vec2(0.0f), glm::vec2(texture.width - 1, texture.height - 1));
+        const size_t x0 = size_t(pos.x), y0 = size_t(pos.y);
+        const size_t x1 = std::min(x0 + 1, texture.width - 1), y1 = std::min(y0 + 1, texture.height - 1);
+        const glm::vec2 t = pos - glm::floor(pos);
+
+        Color const* row0 = texture.buffer + y0*texture.stride;
+        Color const* row1 = texture.buffer + y1*texture.stride;
+
+        return glm::mix(glm::mix(glm::vec4(row0[x0]), glm::vec4(row0[x1]), t.x),
+                        glm::mix(glm::vec4(row1[x0]), glm::vec4(row1[x1]), t.x), t.y);
+    }
+} /* namespace */
+
+shaders::NormalTable::NormalTable(std::function<Color(glm::vec3 normal)> const& fn, size_t size)
+    : size_(std::max<size_t>(size, 1)), scale_(float(size_))
+{
+    std::shared_ptr<std::vector<Color>> colors = std::make_shared<std::vector<Color>>(size_*size_);
+
+    for (size_t y = 0; y < size_; ++y)
+        for (size_t x = 0; x < size_; ++x)
+            (*colors)[y*size_ + x] = fn(octahedralDirection((glm::vec2(x, y) + 0.5f)/scale_*2.0f - 1.0f));
+
+    colors_ = colors;
+}
+
+shaders::SphericalHarmonics shaders::SphericalHarmonics::constant(Color color) {
+    SphericalHarmonics sh = {};
+    sh.coefficients[0] = glm::vec3(color)*(2.0f*std::sqrt(glm::pi<float>()));
+    return sh;
+}
+
+shaders::SphericalHarmonics shaders::SphericalHarmonics::hemisphere(Color sky, Color ground, glm::vec3 up) {
+    // Projection of a step function across the horizon: only the constant
+    // and linear bands are non-zero
+    SphericalHarmonics sh = constant(Color((glm::vec4(sky) + glm::vec4(ground))*0.5f));
+
+    up = glm::normalize(up);
+    const glm::vec3 linear = (glm::vec3(sky) - glm::vec3(ground))*(0.488603f*glm::pi<float>());
+    sh.coefficients[1] = linear*up.y;
+    sh.coefficients[2] = linear*up.z;
+    sh.coefficients[3] = linear*up.x;
+    return sh;
+}
+
+glm::vec3 shaders::SphericalHarmonics::irradiance(glm::vec3 const& n) const {
+    static constexpr float c1 = 0.429043f, c2 = 0.511664f, c3 = 0.743125f, c4 = 0.886227f, c5 = 0.247708f;
+    glm::vec3 const* L = coefficients;
+
+    const glm::vec3 e =
+        c1*L[8]*(n.x*n.x - n.y*n.y) + c3*L[6]*n.z*n.z + c4*L[0] - c5*L[6] +
+        2.0f*c1*(L[4]*n.x*n.y + L[7]*n.x*n.z + L[5]*n.y*n.z) +
+        2.0f*c2*(L[3]*n.x + L[1]*n.y + L[2]*n.z);
+
+    return glm::max(e, glm::vec3(0.0f))/glm::pi<float>();
+}
+
+shaders::NormalTable shaders::lightingTable(Color albedo, std::vector<DirectionalLight> const& lights,
+                                            SphericalHarmonics const& ambient, size_t size)
+{
+    return NormalTable([&](glm::vec3 normal) {
+        glm::vec3 light = ambient.irradiance(normal);
+        for (DirectionalLight const& l: lights)
+            light += glm::max(-glm::dot(normal, glm::normalize(l.direction)), 0.0f)*glm::vec3(l.color);
+
+        return Color(glm::clamp(glm::vec3(albedo)/255.0f*light, 0.0f, 255.0f), albedo.a);
+    }, size);
+}
+
+shaders::NormalTable shaders::matcapTable(Image<Color> const& texture, glm::mat4 const& view, size_t size) {
+    const glm::mat3 rotation(view);
+
+    return NormalTable([&](glm::vec3 normal) {
+        glm::vec3 n = rotation*normal;
+        const float length = glm::length(n);
+        n = (length > 0.0f) ? n/length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+        // Directions facing away from the viewer map to the rim
+        glm::vec2 p(n);
+        if (n.z < 0.0f && glm::dot(p, p) > 0.0f)
+            p = glm::normalize(p);
+
+        return Color(glm::clamp(sample(texture, glm::vec2(0.5f + 0.5f*p.x, 0.5f - 0.5f*p.y)) + 0.5f, 0.0f, 255.0f));
+    }, size);
 }
@@ -25,13 +25,20 @@
 #pragma once
 
 #include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x3.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <istream>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -91,6 +98,252 @@ private:
     Error loadBinarySTL(std::istream& stream, bool useNormals, size_t skipped);
 };
 
+// Non-owning view of faces stored at a fixed distance (stride, in bytes)
+// from each other, e.g. the 50-byte records of a binary STL file. Face data
+// need not be aligned. An optional index list selects faces in any order.
+class FaceView {
+public:
+    static constexpr size_t BinarySTLStride = 50;
+
+    FaceView(Model const& model)
+        : FaceView(model.data(), model.size())
+        {}
+
+    explicit FaceView(Face const* faces, size_t count)
+        : FaceView(faces, count, sizeof(Face))
+        {}
+
+    // When useNormals is false, normals are recomputed from vertex data
+    explicit FaceView(void const* data, size_t count, size_t stride, bool useNormals = true)
+        : data_(static_cast<unsigned char const*>(data)), count_(count), stride_(stride),
+          indices_(nullptr), useNormals_(useNormals)
+        {}
+
+    // Returns a view of the records of an in-memory binary STL file,
+    // or an empty view if size is not consistent with the face count
+    static FaceView fromBinarySTL(void const* data, size_t size, bool useNormals = false);
+
+    // Returns a view of faces [first, first + count) of this view
+    FaceView slice(size_t first, size_t count) const {
+        FaceView view(*this);
+        if (indices_)
+            view.indices_ += first;
+        else
+            view.data_ += first*stride_;
+        view.count_ = count;
+        return view;
+    }
+
+    // Returns a view of the faces of this view selected by indices.
+    // This view must not already be indexed.
+    FaceView indexed(uint32_t const* indices, size_t count) const {
+        FaceView view(*this);
+        view.indices_ = indices;
+        view.count_ = count;
+        return view;
+    }
+
+    size_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    Face operator[](size_t i) const {
+        Face face;
+        std::memcpy(&face, data_ + (indices_ ? size_t(indices_[i]) : i)*stride_, sizeof(Face));
+        if (!useNormals_)
+            face.normal = glm::normalize(glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]));
+        return face;
+    }
+
+private:
+    unsigned char const* data_;
+    size_t count_;
+    size_t stride_;
+    uint32_t const* indices_;
+    bool useNormals_;
+};
+
+// Unit vector stored in 32 bits: the octahedral mapping unfolds the unit
+// sphere onto a square, whose coordinates are quantized to 16 bits each
+struct PackedNormal {
+    PackedNormal() = default;
+
+    explicit PackedNormal(glm::vec3 const& normal);
+
+    glm::vec3 unpack() const {
+        glm::vec2 p = glm::vec2(x, y)/32767.0f;
+        const float z = 1.0f - std::abs(p.x) - std::abs(p.y);
+        if (z < 0.0f)
+            p = (1.0f - glm::abs(glm::vec2(p.y, p.x)))*glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+        return glm::normalize(glm::vec3(p, z));
+    }
+
+    bool operator==(PackedNormal const& other) const {
+        return x == other.x && y == other.y;
+    }
+
+    int16_t x, y;
+};
+
+// Mesh with vertices shared between faces: each face is made of three
+// consecutive entries of indices, which refer to elements of vertices
+struct IndexedMesh {
+    // Number of entries in the transformed vertex cache used by render()
+    static constexpr size_t VertexCacheSize = 16;
+
+    IndexedMesh() = default;
+
+    // Merges bitwise equal vertices of model
+    explicit IndexedMesh(Model const& model);
+
+    size_t size() const {
+        return indices.size()/3;
+    }
+
+    // Reorders faces for reuse of transformed vertices (Tipsify algorithm)
+    void optimizeVertexCache(size_t cacheSize = VertexCacheSize);
+
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    AABB boundingBox;
+
+    // Per-vertex normals, empty unless built by smoothNormals()
+    std::vector<PackedNormal> normals;
+
+    // Per-vertex fraction of ambient light, empty unless built by
+    // bakeOcclusion()
+    std::vector<float> occlusion;
+};
+
+// Collection of meshes placed in the world by their own transforms.
+// Objects are grouped in a bounding volume hierarchy over their world-space
+// bounding boxes, so that whole groups can be culled at once and drawn
+// front to back. Meshes are not copied: they must outlive the scene.
+class Scene {
+public:
+    struct Object {
+        FaceView faces;
+        AABB localBounds;
+        glm::mat4 transform;
+        AABB bounds;
+    };
+
+    // Returns the index of the new object. The hierarchy must be rebuilt
+    // by calling build() before rendering.
+    size_t add(FaceView const& faces, AABB const& localBounds, glm::mat4 const& transform = glm::mat4(1.0f));
+
+    size_t add(Model const& model, glm::mat4 const& transform = glm::mat4(1.0f)) {
+        return add(FaceView(model), model.boundingBox(), transform);
+    }
+
+    void clear() {
+        objects_.clear();
+        nodes_.clear();
+        order_.clear();
+    }
+
+    void build();
+
+    bool built() const {
+        return order_.size() == objects_.size();
+    }
+
+    size_t size() const {
+        return objects_.size();
+    }
+
+    Object const& operator[](size_t i) const {
+        return objects_[i];
+    }
+
+    // World-space bounding box of all objects, valid after build()
+    AABB boundingBox() const {
+        return nodes_.empty() ? AABB{ glm::vec3(0.0f), glm::vec3(0.0f) } : nodes_.front().bounds;
+    }
+
+    // Hierarchy nodes, root first. Leaves (count > 0) refer to objects
+    // order()[first, first + count); inner nodes (count == 0) have
+    // children first and first + 1
+    struct Node {
+        AABB bounds;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    std::vector<Node> const& nodes() const {
+        return nodes_;
+    }
+
+    std::vector<uint32_t> const& order() const {
+        return order_;
+    }
+
+private:
+    void buildNode(size_t node, uint32_t first, uint32_t count);
+
+    std::vector<Object> objects_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> order_;
+};
+
+enum NormalWeighting : uint8_t {
+    WeightByArea = 0,
+    WeightByAngle
+};
+
+// Builds an indexed mesh with smooth vertex normals. Vertices closer than
+// tolerance, relative to the size of the model, are welded by spatial
+// hashing (with tolerance 0, only equal vertices are). The normal of a face
+// corner averages the normals of the faces around its vertex, weighted by
+// area or by corner angle, leaving out those at more than creaseAngle
+// (radians) from its own face: vertices on creases are split. Uses up to
+// threadCount threads (0 picks the number of hardware threads)
+IndexedMesh smoothNormals(Model const& model, float creaseAngle = glm::radians(45.0f),
+                          NormalWeighting weighting = WeightByAngle,
+                          float tolerance = 1e-5f, unsigned int threadCount = 0);
+
+// Meshes with the transforms of all their copies, e.g. the parts of a
+// flattened assembly as found by findInstances()
+struct InstancedModel {
+    struct Mesh {
+        Model model;
+        std::vector<glm::mat4> instances;
+    };
+
+    std::vector<Mesh> meshes;
+
+    // Returns the number of unique faces
+    size_t faceCount() const;
+
+    // Returns the number of faces after instancing
+    size_t instancedFaceCount() const;
+};
+
+// Splits model into connected components (faces sharing vertices) and
+// groups components that are rigid copies of each other, within a tolerance
+// relative to the size of the model, whatever the order of their faces and
+// of the vertices within faces. Each group becomes a mesh, in the
+// coordinates of its first copy, with one transform per copy; components
+// without copies are merged into a single mesh with an identity transform.
+InstancedModel findInstances(Model const& model, float tolerance = 1e-5f);
+
+// Reorders the faces of model, once at load time, for vertex locality
+// and reduced overdraw from any viewpoint (Sander et al., 2007): faces are
+// ordered by Tipsify for a vertex cache of cacheSize entries and split into
+// clusters, which are then sorted so that those on the outside of the model
+// are drawn first. Lower values of lambda make for fewer, larger clusters
+void optimizeFaceOrder(Model& model, size_t cacheSize = 16, float lambda = 0.75f);
+
+// Sorts the faces of model along a Morton (Z-order) curve through their
+// centroids, so that consecutive faces are close in space and touch nearby
+// pixels. Sorting uses up to threadCount threads (0 picks the number of
+// hardware threads)
+void sortFacesMorton(Model& model, unsigned int threadCount = 0);
+
 struct Projection : glm::mat4 {
     using glm::mat4::mat;
 
@@ -155,11 +408,631 @@ enum CullingMode : uint8_t {
     CullFront = CullCCW
 };
 
+// Building blocks of the renderer, exposed for the templated render overloads
+namespace detail {
+    using vec2s = glm::vec<2, size_t>;
+
+    // Per-call state shared by all faces: transforms vertices and scan
+    // converts faces, updating the depth buffer. Faces are not culled by
+    // winding here: every render path runs a BackfaceCuller first
+    class Rasterizer {
+    public:
+        Rasterizer(Image<float> const& depth, glm::mat4 const& modelViewProj);
+
+        // Transforms vertex to normalized device coordinates.
+        // w holds the reciprocal of clip space w
+        glm::vec4 transform(glm::vec3 const& vertex) const {
+            if (affine)
+                return glm::vec4(affineTransform*glm::vec4(vertex, 1.0f), 1.0f);
+
+            const glm::vec4 clip = modelViewProj*glm::vec4(vertex, 1.0f);
+            return glm::vec4(glm::vec3(clip)/clip.w, 1.0f/clip.w);
+        }
+
+        // Draws a face whose vertices were transformed by transform().
+        // For each covered pixel that passes the depth test, the depth buffer
+        // is updated, then fragment(x, y, frag, lambda) is called with the
+        // screen-space barycentric coordinates lambda of the pixel center.
+        // Returns true if the face was rasterized (i.e. not degenerate nor clipped)
+        template<typename Fragment>
+        bool draw(glm::vec4 const (&ndc)[3], Fragment const& fragment) const;
+
+    protected:
+        Image<float> const& depth;
+        glm::mat4 const& modelViewProj;
+
+        // Orthographic projections (possibly combined with affine model and
+        // view transforms) leave w constant: the divide is folded into the
+        // matrix and the w row is dropped
+        const bool affine;
+        const glm::mat4x3 affineTransform;
+
+        const vec2s imgSize;
+        const glm::vec2 imgSizef;
+        const glm::vec2 sampleStep;
+    };
+
+    template<typename Fragment>
+    bool Rasterizer::draw(glm::vec4 const (&ndc)[3], Fragment const& fragment) const {
+        // Signed area; faces of either winding are drawn
+        const float doubleArea = ((ndc[0].y - ndc[1].y)*ndc[2].x + (ndc[1].x - ndc[0].x)*ndc[2].y + (ndc[0].x*ndc[1].y - ndc[0].y*ndc[1].x));
+        if (doubleArea == 0.0f)
+            return false;
+
+        AABB brect = {
+            glm::min(ndc[0], glm::min(ndc[1], ndc[2])),
+            glm::max(ndc[0], glm::max(ndc[1], ndc[2]))
+        };
+
+        brect.from = glm::max(brect.from, glm::vec3(-1.0f, -1.0f, -1.0f));
+        brect.to = glm::min(brect.to, glm::vec3(1.0f, 1.0f, 1.0f));
+        const auto dims = glm::abs(brect.to - brect.from);
+
+        // Discard faces outside clipping planes
+        if (dims.x <= 0.0f || dims.y <= 0.0f || brect.from.z >= 1.0f || brect.to.z <= -1.0f)
+            return false;
+
+        const vec2s from =
+            glm::clamp(vec2s(glm::floor((glm::vec2(brect.from.x, -brect.to.y)*0.5f + 0.5f)*imgSizef)), vec2s(0, 0), imgSize);
+        const vec2s to =
+            glm::clamp(vec2s(glm::ceil((glm::vec2(brect.to.x, -brect.from.y)*0.5f + 0.5f)*imgSizef)), vec2s(0, 0), imgSize);
+
+        // Matrix for computing barycentric coordinates normalized so their sum is 1
+        // XXX: column-major
+        const glm::mat3 barycentric = glm::mat3{
+            { ndc[1].y - ndc[2].y,                   ndc[2].y - ndc[0].y,                   ndc[0].y - ndc[1].y },
+            { ndc[2].x - ndc[1].x,                   ndc[0].x - ndc[2].x,                   ndc[1].x - ndc[0].x },
+            { ndc[1].x*ndc[2].y - ndc[1].y*ndc[2].x, ndc[2].x*ndc[0].y - ndc[2].y*ndc[0].x, ndc[0].x*ndc[1].y - ndc[0].y*ndc[1].x },
+        } / doubleArea;
+
+        const glm::vec3 zParams(ndc[0].z, ndc[1].z - ndc[0].z, ndc[2].z - ndc[0].z);
+
+        const glm::vec2 sampleStart = (glm::vec2(from.x + 0.5f, from.y + 0.5f)/imgSizef - 0.5f) * glm::vec2(2.0f, -2.0f);
+        glm::vec2 sample = sampleStart;
+
+        glm::vec3 rowLambda = barycentric * glm::vec3(sampleStart, 1.0f);
+        glm::vec3 lambda = rowLambda;
+
+        const glm::vec3 rowLambdaStep = barycentric[1]*sampleStep.y;
+        const glm::vec3 lambdaStep = barycentric[0]*sampleStep.x;
+
+        for (size_t y = from.y; y < to.y; ++y, sample.y += sampleStep.y, rowLambda += rowLambdaStep) {
+            sample.x = sampleStart.x;
+            lambda = rowLambda;
+
+            for (size_t x = from.x; x < to.x; ++x, sample.x += sampleStep.x, lambda += lambdaStep) {
+                const float z = zParams.x + lambda.y*zParams.y + lambda.z*zParams.z;
+
+                // Test if inside triangle, then depth test. Attributes are
+                // interpolated by fragment, only for pixels that pass
+                if (!(std::signbit(lambda.x) | std::signbit(lambda.y) | std::signbit(lambda.z)) &&
+                    z > -1.0f && z < depth.buffer[y*depth.stride + x])
+                {
+                    depth.buffer[y*depth.stride + x] = z;
+                    fragment(x, y, glm::vec3(sample, z), lambda);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // Varyings are decoded once per face, before interpolation
+    template<typename T>
+    T const& unpack(T const& value) {
+        return value;
+    }
+
+    inline glm::vec3 unpack(PackedNormal const& normal) {
+        return normal.unpack();
+    }
+
+    // Converts screen-space barycentric coordinates to perspective-correct
+    // ones, given vertices transformed by Rasterizer::transform()
+    inline glm::vec3 perspective(glm::vec3 const& lambda, glm::vec4 const (&ndc)[3]) {
+        const glm::vec3 weights = lambda*glm::vec3(ndc[0].w, ndc[1].w, ndc[2].w);
+        return weights/(weights.x + weights.y + weights.z);
+    }
+
+    // FIFO cache of transformed vertices
+    class VertexCache {
+    public:
+        VertexCache() {
+            std::fill(tags_, tags_ + Size, std::numeric_limits<uint32_t>::max());
+        }
+
+        glm::vec4 fetch(uint32_t index, glm::vec3 const& vertex, Rasterizer const& rasterizer) {
+            for (size_t i = 0; i < Size; ++i)
+                if (tags_[i] == index)
+                    return values_[i];
+
+            const size_t slot = next_;
+            next_ = (next_ + 1) % Size;
+
+            tags_[slot] = index;
+            return values_[slot] = rasterizer.transform(vertex);
+        }
+
+    private:
+        static constexpr size_t Size = IndexedMesh::VertexCacheSize;
+
+        uint32_t tags_[Size];
+        glm::vec4 values_[Size];
+        size_t next_ = 0;
+    };
+
+    // Back-face culling in model space, before vertices are transformed.
+    // For a face in front of the viewer, the signed area of its projection
+    // has the sign of -det(modelViewProj)*dot(n, e.xyz - e.w*v), where n
+    // is the normal given by the winding order, v any vertex, and e the
+    // viewer in homogeneous model coordinates.
+    class BackfaceCuller {
+    public:
+        static constexpr size_t BlockSize = 64;
+
+        BackfaceCuller(glm::mat4 const& modelViewProj, CullingMode cullingMode);
+
+        bool enabled() const {
+            return enabled_;
+        }
+
+        // The normal comes from the vertices rather than Face::normal:
+        // stored normals may be zero or disagree with the winding order,
+        // which alone decides what CullingMode keeps
+        bool visible(glm::vec3 const& v0, glm::vec3 const& v1, glm::vec3 const& v2) const {
+            const glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
+            return (sign*glm::dot(n, glm::vec3(eye) - eye.w*v0) > 0.0f) != flip;
+        }
+
+        bool visible(Face const& face) const {
+            return visible(face.vertex[0], face.vertex[1], face.vertex[2]);
+        }
+
+        // Tests a block of faces, one at a time. Returns the number of
+        // visible faces, whose indices go to visible
+        size_t test(Face const* faces, size_t count, uint8_t* visible) const {
+            uint8_t flags[BlockSize];
+            for (size_t i = 0; i < count; ++i)
+                flags[i] = uint8_t(this->visible(faces[i]));
+
+            size_t n = 0;
+            for (size_t i = 0; i < count; ++i) {
+                visible[n] = uint8_t(i);
+                n += flags[i];
+            }
+
+            return n;
+        }
+
+    private:
+        const glm::vec4 eye;
+        const float sign;
+        const bool enabled_, flip;
+    };
+} /* namespace detail */
+
+// Returns the position of the viewer in the coordinate system transformed
+// by modelViewProj, in homogeneous coordinates. For perspective projections
+// w is 1; for parallel projections w is 0 and xyz is the unit direction
+// pointing toward the viewer
+glm::vec4 viewPoint(glm::mat4 const& modelViewProj);
+
 // Returns number of faces actually rendered
 size_t render(Image<Color> const& color, Image<float> const& depth,
-              Model const& model, glm::mat4 const& modelViewProj,
+              FaceView const& faces, glm::mat4 const& modelViewProj,
               Shader const& shader, CullingMode cullingMode = CullCW);
 
+inline size_t render(Image<Color> const& color, Image<float> const& depth,
+                     Model const& model, glm::mat4 const& modelViewProj,
+                     Shader const& shader, CullingMode cullingMode = CullCW)
+{
+    return render(color, depth, FaceView(model), modelViewProj, shader, cullingMode);
+}
+
+inline size_t render(Image<Color> const& color, Image<float> const& depth,
+                     Face const* faces, size_t count, glm::mat4 const& modelViewProj,
+                     Shader const& shader, CullingMode cullingMode = CullCW)
+{
+    return render(color, depth, FaceView(faces, count), modelViewProj, shader, cullingMode);
+}
+
+// Transformed vertices are kept in a small FIFO cache, so that vertices
+// shared by nearby faces are usually transformed only once. Normals are
+// computed from vertex data
+size_t render(Image<Color> const& color, Image<float> const& depth,
+              IndexedMesh const& mesh, glm::mat4 const& modelViewProj,
+              Shader const& shader, CullingMode cullingMode = CullCW);
+
+// Renders mesh with user-defined vertex attributes (varyings): varyings
+// points to one value per vertex of mesh. Values are interpolated with
+// perspective correction, only for pixels that pass coverage and depth
+// tests, and passed to shader, a callable taking the fragment coordinates
+// and the interpolated value:
+//     Color shader(glm::vec3 frag, Varying const& varying)
+// Varying may be any type supporting addition and multiplication by a
+// float (e.g. glm vectors, or a struct of them with suitable operators).
+// PackedNormal values are unpacked to glm::vec3 before interpolation.
+// Several attributes are passed as one struct, not as a compile-time list,
+// and interpolation is scalar code, one pixel at a time: the struct's
+// operators decide how much work each pixel costs.
+// Returns number of faces actually rendered
+template<typename Varying, typename VaryingShader>
+size_t render(Image<Color> const& color, Image<float> const& depth,
+              IndexedMesh const& mesh, Varying const* varyings,
+              glm::mat4 const& modelViewProj, VaryingShader const& shader,
+              CullingMode cullingMode = CullCW)
+{
+    assert(color.width == depth.width && color.height == depth.height);
+
+    const detail::Rasterizer rasterizer(depth, modelViewProj);
+    const detail::BackfaceCuller culler(modelViewProj, cullingMode);
+    detail::VertexCache cache;
+    size_t faceCount = 0;
+
+    for (size_t i = 0, count = mesh.indices.size(); i + 2 < count; i += 3) {
+        uint32_t const* index = &mesh.indices[i];
+        if (culler.enabled() && !culler.visible(mesh.vertices[index[0]], mesh.vertices[index[1]], mesh.vertices[index[2]]))
+            continue;
+
+        glm::vec4 ndc[3];
+        for (int k = 0; k < 3; ++k)
+            ndc[k] = cache.fetch(index[k], mesh.vertices[index[k]], rasterizer);
+
+        auto const& a = detail::unpack(varyings[index[0]]);
+        auto const& b = detail::unpack(varyings[index[1]]);
+        auto const& c = detail::unpack(varyings[index[2]]);
+
+        faceCount += rasterizer.draw(ndc, [&](size_t x, size_t y, glm::vec3 const& frag, glm::vec3 const& lambda) {
+            const glm::vec3 w = detail::perspective(lambda, ndc);
+            color.buffer[y*color.stride + x] = shader(frag, a*w.x + b*w.y + c*w.z);
+        });
+    }
+
+    return faceCount;
+}
+
+// Depth-only rendering: updates depth as render() does, without color
+// target nor shader, e.g. for shadow maps, occlusion tests or depth export.
+// Returns number of faces actually rendered
+size_t render(Image<float> const& depth, FaceView const& faces,
+              glm::mat4 const& modelViewProj, CullingMode cullingMode = CullCW);
+
+inline size_t render(Image<float> const& depth, Model const& model,
+                     glm::mat4 const& modelViewProj, CullingMode cullingMode = CullCW)
+{
+    return render(depth, FaceView(model), modelViewProj, cullingMode);
+}
+
+size_t render(Image<float> const& depth, IndexedMesh const& mesh,
+              glm::mat4 const& modelViewProj, CullingMode cullingMode = CullCW);
+
+// Face id rendering, for picking: for each pixel that passes the depth
+// test, writes the index in faces of the face seen there. Other pixels keep
+// their value, so ids should be cleared first (e.g. to RayHit::None).
+// Returns number of faces actually rendered
+size_t render(Image<uint32_t> const& ids, Image<float> const& depth,
+              FaceView const& faces, glm::mat4 const& modelViewProj,
+              CullingMode cullingMode = CullCW);
+
+inline size_t render(Image<uint32_t> const& ids, Image<float> const& depth,
+                     Model const& model, glm::mat4 const& modelViewProj,
+                     CullingMode cullingMode = CullCW)
+{
+    return render(ids, depth, FaceView(model), modelViewProj, cullingMode);
+}
+
+// Returns a matrix that maps the window of pixels [x, x + width) x
+// [y, y + height) of a viewportWidth x viewportHeight image onto a whole
+// width x height image. Rendering with scissorMatrix(...)*modelViewProj
+// produces that window alone, e.g. a few pixels around the cursor
+glm::mat4 scissorMatrix(size_t x, size_t y, size_t width, size_t height,
+                        size_t viewportWidth, size_t viewportHeight);
+
+// Renders one copy of faces for each of the instanceCount model matrices
+// pointed to by instances. Instances whose transformed bounding box lies
+// outside the view frustum are skipped. Shaders receive world-space
+// positions and normals. Returns number of faces actually rendered
+size_t render(Image<Color> const& color, Image<float> const& depth,
+              FaceView const& faces, AABB const& boundingBox,
+              glm::mat4 const* instances, size_t instanceCount,
+              glm::mat4 const& viewProj, Shader const& shader, CullingMode cullingMode = CullCW);
+
+inline size_t render(Image<Color> const& color, Image<float> const& depth,
+                     Model const& model, glm::mat4 const* instances, size_t instanceCount,
+                     glm::mat4 const& viewProj, Shader const& shader, CullingMode cullingMode = CullCW)
+{
+    return render(color, depth, FaceView(model), model.boundingBox(),
+                  instances, instanceCount, viewProj, shader, cullingMode);
+}
+
+// Renders all objects in scene, which must have been built, skipping
+// hierarchy nodes outside the view frustum and drawing visible objects
+// roughly front to back. Shaders receive world-space positions and normals.
+// Returns number of faces actually rendered
+size_t render(Image<Color> const& color, Image<float> const& depth,
+              Scene const& scene, glm::mat4 const& viewProj,
+              Shader const& shader, CullingMode cullingMode = CullCW);
+
+// Returns, for each face, whether it is visible from outside the model
+// along at least one of directionCount directions evenly spread over the
+// sphere. Each direction is tested by rendering face ids in an orthographic
+// view of resolution x resolution pixels, so faces smaller than a pixel may
+// be reported as hidden.
+std::vector<bool> findVisibleFaces(FaceView const& faces, AABB const& boundingBox,
+                                   size_t directionCount = 64, size_t resolution = 512);
+
+// Returns a copy of model without the faces that findVisibleFaces()
+// reports as hidden, e.g. the internal parts of an assembly
+Model removeHiddenFaces(Model const& model, size_t directionCount = 64, size_t resolution = 512);
+
+// Direction-bucketed potentially visible sets, for models rendered over
+// and over from a known range of directions (e.g. turntables or camera
+// presets). The sphere of view directions is split into buckets, the cells
+// of a cube map with subdivisions x subdivisions cells per side; for each
+// bucket, the indices of faces seen from a grid of (samples + 1)^2
+// directions over its cell, edges included (in views like those of
+// findVisibleFaces), are recorded. Faces that never cover a pixel center
+// of these views (e.g. thin faces seen edge-on) may be missed, so
+// resolution should be well above that of the rendered images.
+class VisibilitySets {
+public:
+    void build(FaceView const& faces, AABB const& boundingBox,
+               size_t subdivisions = 2, size_t resolution = 512, size_t samples = 4);
+
+    void build(Model const& model, size_t subdivisions = 2, size_t resolution = 512, size_t samples = 4) {
+        build(model, model.boundingBox(), subdivisions, resolution, samples);
+    }
+
+    size_t bucketCount() const {
+        return sets_.size();
+    }
+
+    // Returns the bucket containing direction (pointing toward the viewer)
+    size_t bucket(glm::vec3 const& direction) const;
+
+    std::vector<uint32_t> const& faces(size_t bucket) const {
+        return sets_[bucket];
+    }
+
+    // Returns a view of the faces potentially visible when faces, enclosed
+    // by boundingBox, are rendered with modelViewProj: the union of the
+    // buckets whose cells overlap the directions from the box toward the
+    // viewer, or all faces when the viewer is inside the box. faces must
+    // not be indexed. When several buckets are merged, their union is
+    // written to selection, which the view then references: the view is
+    // valid until selection is modified or build() is called. Concurrent
+    // calls are safe, given distinct selection buffers
+    FaceView select(FaceView const& faces, glm::mat4 const& modelViewProj, AABB const& boundingBox,
+                    std::vector<uint32_t>& selection) const;
+
+    FaceView select(Model const& model, glm::mat4 const& modelViewProj, std::vector<uint32_t>& selection) const {
+        return select(model, modelViewProj, model.boundingBox(), selection);
+    }
+
+private:
+    size_t subdivisions_ = 0;
+    float spacing_ = 0.0f;
+    std::vector<std::vector<uint32_t>> sets_;
+    std::vector<glm::vec4> cells_; // Center direction and angular radius of each cell
+};
+
+// Depth of a scene as seen from a light, for shadow tests. lightViewProj
+// is the projection times the view of the light, e.g. an orthographic
+// Projection times a Camera for a directional light (see directional()).
+// Copies share the same depth buffer
+class ShadowMap {
+public:
+    ShadowMap(glm::mat4 const& lightViewProj, size_t width, size_t height);
+
+    // Returns a transform from a light shining in direction to an
+    // orthographic view that encloses boundingBox
+    static glm::mat4 directional(glm::vec3 const& direction, AABB const& boundingBox);
+
+    // Clears the map
+    void clear();
+
+    // Adds faces, transformed by model, to the map. Both sides of faces
+    // cast shadows by default. Returns number of faces actually rendered
+    size_t render(FaceView const& faces, glm::mat4 const& model = glm::mat4(1.0f), CullingMode cullingMode = CullNone);
+
+    // Fraction of light reaching point pos, on a surface with the given
+    // normal, averaged over (2*radius + 1)^2 texels around pos (percentage
+    // closer filtering). pos is offset along normal by one to two texels,
+    // more at grazing angles, to avoid self-shadowing. Points outside the map are lit
+    float visibility(glm::vec3 const& pos, glm::vec3 const& normal, int radius = 1) const;
+
+    Image<float> depth() const {
+        return Image<float>(buffer_->data(), width_, height_);
+    }
+
+    glm::mat4 const& lightViewProj() const {
+        return lightViewProj_;
+    }
+
+private:
+    glm::mat4 lightViewProj_;
+    size_t width_, height_;
+    float texelSize_;
+    std::shared_ptr<std::vector<float>> buffer_;
+};
+
+// Screen-space ambient occlusion, as a post-process over a depth buffer
+// filled by render() with modelViewProj. Positions and normals are
+// reconstructed from depth, as render() produces no normal buffer; each
+// pixel samples a disc of neighbours spanning radius (in model space) on
+// screen, far ones at reduced resolution, and the result is smoothed by a
+// separable blur that preserves depth edges. The cost depends only on image
+// size. Writes the fraction of ambient light reaching each pixel to
+// occlusion, 1 on the background. All passes are scalar code, split in rows
+// or tiles over up to threadCount threads (0 picks the number of hardware
+// threads)
+void ambientOcclusion(Image<float> const& occlusion, Image<float> const& depth,
+                      glm::mat4 const& modelViewProj, float radius, unsigned int threadCount = 0);
+
+// Same as above, darkening color by the occlusion term scaled by strength
+void ambientOcclusion(Image<Color> const& color, Image<float> const& depth,
+                      glm::mat4 const& modelViewProj, float radius, float strength = 1.0f,
+                      unsigned int threadCount = 0);
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+// Closest intersection found along a ray. The hit point is
+// vertex[0] + barycentric.x*(vertex[1] - vertex[0]) + barycentric.y*(vertex[2] - vertex[0])
+struct RayHit {
+    static constexpr uint32_t None = 0xffffffffu;
+
+    uint32_t face;
+    float distance;
+    glm::vec2 barycentric;
+
+    explicit operator bool() const {
+        return face != None;
+    }
+};
+
+// Bounding volume hierarchy over faces, for ray queries. Faces are copied
+// in leaf order, so the source does not need to outlive the hierarchy.
+// Distances along rays are in units of the length of their direction
+class BVH {
+public:
+    // Builds the hierarchy with the surface area heuristic, evaluated over
+    // a fixed number of bins per axis. Subtrees are built in parallel by up
+    // to threadCount threads (0 picks the number of hardware threads)
+    void build(FaceView const& faces, unsigned int threadCount = 0);
+
+    void build(Model const& model, unsigned int threadCount = 0) {
+        build(FaceView(model), threadCount);
+    }
+
+    void clear() {
+        nodes_.clear();
+        triangles_.clear();
+    }
+
+    size_t size() const {
+        return triangles_.size();
+    }
+
+    AABB boundingBox() const {
+        return nodes_.empty() ? AABB{ glm::vec3(0.0f), glm::vec3(0.0f) } : nodes_.front().bounds;
+    }
+
+    // Returns true if ray hits any face at a distance in (0, maxDistance)
+    bool occluded(Ray const& ray, float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+    // Same as above for packets of rays, traversing the hierarchy once for
+    // the whole packet: rays should be coherent (e.g. share their origin).
+    // Bit i of the result is set if rays[i] is occluded
+    unsigned int occluded(Ray const (&rays)[4], float maxDistance = std::numeric_limits<float>::infinity()) const;
+    unsigned int occluded(Ray const (&rays)[8], float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+    // Returns the closest face hit by ray at a distance in (0, maxDistance),
+    // with face set to its index in the source view, or RayHit::None.
+    // Winding is judged as seen from the ray origin: with CullCW, faces
+    // that appear clockwise are skipped, and conversely for CullCCW
+    RayHit intersect(Ray const& ray, float maxDistance = std::numeric_limits<float>::infinity(),
+                     CullingMode cullingMode = CullNone) const;
+
+    // Same as above for packets of coherent rays
+    void intersect(Ray const (&rays)[4], RayHit (&hits)[4],
+                   float maxDistance = std::numeric_limits<float>::infinity(),
+                   CullingMode cullingMode = CullNone) const;
+    void intersect(Ray const (&rays)[8], RayHit (&hits)[8],
+                   float maxDistance = std::numeric_limits<float>::infinity(),
+                   CullingMode cullingMode = CullNone) const;
+
+    // Hierarchy nodes, root first. Leaves (count > 0) refer to faces
+    // [first, first + count) in leaf order; inner nodes (count == 0) have
+    // children first and first + 1
+    struct Node {
+        AABB bounds;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    std::vector<Node> const& nodes() const {
+        return nodes_;
+    }
+
+    // Index in the source view of the i-th face in leaf order
+    uint32_t face(size_t i) const {
+        return triangles_[i].face;
+    }
+
+private:
+    // Precomputed edges for Moller-Trumbore intersection
+    struct Triangle {
+        glm::vec3 vertex, edge1, edge2;
+        uint32_t face;
+    };
+
+    template<size_t N>
+    unsigned int occludedPacket(Ray const (&rays)[N], float maxDistance) const;
+
+    template<size_t N>
+    void intersectPacket(Ray const (&rays)[N], RayHit (&hits)[N], float maxDistance, CullingMode cullingMode) const;
+
+    std::vector<Node> nodes_;
+    std::vector<Triangle> triangles_;
+};
+
+// Bakes ambient occlusion at the vertices of mesh into mesh.occlusion: the
+// fraction of samples cosine-distributed over the hemisphere around the
+// vertex normal that travel farther than distance without hitting faces of
+// bvh, usually built from the same model. Normals are taken from
+// mesh.normals if present, else averaged from faces. samples is rounded up
+// to a multiple of 8. Uses up to threadCount threads (0 picks the number of
+// hardware threads). The result can be passed to render() as a varying
+void bakeOcclusion(IndexedMesh& mesh, BVH const& bvh, float distance,
+                   size_t samples = 64, unsigned int threadCount = 0);
+
+// Ray-cast rendering: casts one ray per pixel center through bvh, which
+// must have been built from faces, and calls shader with the same inputs
+// as the rasterizing render() above, so both produce the same image up to
+// rounding. The cost grows with the number of pixels rather than faces.
+// Rows are split between up to threadCount threads (0 picks the number of
+// hardware threads): shader must be safe to call concurrently.
+// Returns number of pixels shaded
+size_t render(Image<Color> const& color, Image<float> const& depth,
+              FaceView const& faces, BVH const& bvh, glm::mat4 const& modelViewProj,
+              Shader const& shader, CullingMode cullingMode = CullCW, unsigned int threadCount = 0);
+
+inline size_t render(Image<Color> const& color, Image<float> const& depth,
+                     Model const& model, BVH const& bvh, glm::mat4 const& modelViewProj,
+                     Shader const& shader, CullingMode cullingMode = CullCW, unsigned int threadCount = 0)
+{
+    return render(color, depth, FaceView(model), bvh, modelViewProj, shader, cullingMode, threadCount);
+}
+
+// Ray-cast face id rendering: same as the rasterizing overload above,
+// with ids taken from bvh, whose source view provides the face indices
+size_t render(Image<uint32_t> const& ids, Image<float> const& depth,
+              BVH const& bvh, glm::mat4 const& modelViewProj,
+              CullingMode cullingMode = CullCW, unsigned int threadCount = 0);
+
+// Single-threaded costs, in nanoseconds, of the steps compared by
+// preferRayCasting(). Defaults were measured on a desktop x86-64 CPU with
+// the built-in shaders, at images of up to a few megapixels; other machines,
+// costly shaders or heavy overdraw call for values measured on the target
+struct RenderCosts {
+    double face = 70.0;        // Transforming, culling and setting up a face
+    double pixel = 15.0;       // Scanning and shading a covered pixel
+    double ray = 20.0;         // Setting up and shading a ray
+    double rayLevel = 12.0;    // Each hierarchy level a ray goes through
+    double buildFace = 1000.0; // Building the hierarchy, per face
+};
+
+// Returns true if ray casting faceCount faces into a width x height image
+// is expected to be faster than rasterizing them. Unless hasBVH is set,
+// the cost of building the hierarchy is included. The estimate assumes
+// each pixel is covered about once, and rays traverse about
+// log2(faceCount) levels, as for compact models filling the view
+bool preferRayCasting(size_t faceCount, size_t width, size_t height, bool hasBVH,
+                      RenderCosts const& costs = RenderCosts());
+
 namespace shaders {
     // Depth is scaled from range [-1,1] to range [0,1]
     inline Color depth(glm::vec3 frag, glm::vec3, glm::vec3) {
@@ -192,6 +1065,101 @@ namespace shaders {
             return Color(glm::clamp(color, 0.0f, 255.0f));
         };
     }
+
+    // Like diffuseDirectional, with direct light attenuated by shadows.
+    // map should be rendered with a light shining in direction dir
+    inline Shader shadowedDirectional(ShadowMap const& map, glm::vec3 dir, Color ambient, Color diffuse, int radius = 1) {
+        dir = -glm::normalize(dir);
+        return [map,dir,ambient,diffuse,radius](glm::vec3, glm::vec3 pos, glm::vec3 normal) {
+            float light = glm::max(glm::dot(normal, dir), 0.0f);
+            if (light > 0.0f)
+                light *= map.visibility(pos, normal, radius);
+
+            glm::vec4 color = glm::vec4(ambient) + light*glm::vec4(diffuse);
+            return Color(glm::clamp(color, 0.0f, 255.0f));
+        };
+    }
+
+    // Colors for all normal directions, sampled on a size x size grid over
+    // the octahedral unfolding of the sphere (see PackedNormal). Lookups
+    // return the nearest sample, so that shading costs one memory access
+    // whatever the computation the table was built from
+    class NormalTable {
+    public:
+        explicit NormalTable(std::function<Color(glm::vec3 normal)> const& fn, size_t size = 256);
+
+        Color operator()(glm::vec3 const& normal) const {
+            const float norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+            if (!(norm > 0.0f))
+                return colors_->front();
+
+            glm::vec2 p = glm::vec2(normal)/norm;
+            if (normal.z < 0.0f)
+                p = (1.0f - glm::abs(glm::vec2(p.y, p.x)))*glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+
+            const glm::vec2 cell = glm::min((p*0.5f + 0.5f)*scale_, scale_ - 0.5f);
+            return (*colors_)[size_t(cell.y)*size_ + size_t(cell.x)];
+        }
+
+    private:
+        size_t size_;
+        float scale_;
+        std::shared_ptr<const std::vector<Color>> colors_;
+    };
+
+    inline Shader normalTable(NormalTable const& table) {
+        return [table](glm::vec3, glm::vec3, glm::vec3 normal) {
+            return table(normal);
+        };
+    }
+
+    // Takes: direction of the light, color of the light
+    struct DirectionalLight {
+        glm::vec3 direction;
+        Color color;
+    };
+
+    // Ambient lighting as second order spherical harmonics coefficients
+    // of incoming radiance, in order L00, L1-1, L10, L11, L2-2, L2-1, L20,
+    // L21, L22, as in Ramamoorthi and Hanrahan, "An Efficient Representation
+    // for Irradiance Environment Maps" (2001)
+    struct SphericalHarmonics {
+        // Uniform light from all directions
+        static SphericalHarmonics constant(Color color);
+
+        // Light of color sky from directions above the plane orthogonal to
+        // up, of color ground from those below
+        static SphericalHarmonics hemisphere(Color sky, Color ground, glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f));
+
+        // Irradiance on a surface with the given unit normal, divided by pi
+        // (i.e. the color of a white diffuse surface)
+        glm::vec3 irradiance(glm::vec3 const& normal) const;
+
+        glm::vec3 coefficients[9];
+    };
+
+    // Diffuse surface of color albedo lit by any number of directional
+    // lights plus ambient light, baked into a NormalTable of the given size
+    NormalTable lightingTable(Color albedo, std::vector<DirectionalLight> const& lights,
+                              SphericalHarmonics const& ambient, size_t size = 256);
+
+    inline Shader lighting(Color albedo, std::vector<DirectionalLight> const& lights,
+                           SphericalHarmonics const& ambient, size_t size = 256)
+    {
+        return normalTable(lightingTable(albedo, lights, ambient, size));
+    }
+
+    // Material capture: colors come from texture, a picture of a sphere
+    // seen from the front, at the point where the sphere has the same normal
+    // as the fragment in view space. view transforms normals as passed to
+    // the shader into view space (e.g. the model-view matrix). The texture
+    // is sampled once into a NormalTable of the given size, so it need not
+    // outlive the shader
+    NormalTable matcapTable(Image<Color> const& texture, glm::mat4 const& view, size_t size = 256);
+
+    inline Shader matcap(Image<Color> const& texture, glm::mat4 const& view, size_t size = 256) {
+        return normalTable(matcapTable(texture, view, size));
+    }
 } /* namespace shaders */
 
 } /* namespace rendirt */
@@ -0,0 +1,81 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rd = rendirt;
+
+namespace {
+    // Largest difference between depth values
+    float depthError(test::Frame const& a, test::Frame const& b) {
+        float error = 0.0f;
+        for (size_t i = 0; i < a.depths.size(); ++i)
+            error = std::max(error, std::abs(a.depths[i] - b.depths[i]));
+        return error;
+    }
+} /* namespace */
+
+// Orthographic views render the same on the affine path as through the
+// perspective divide
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+    const glm::mat4 projection = rd::Projection(rd::Projection::Orthographic, -2.0f, 2.0f, -1.5f, 1.5f, 0.5f, 10.0f);
+
+    const glm::vec3 positions[] = {
+        glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(2.0f, 3.0f, 1.0f), glm::vec3(-1.0f, -3.0f, -2.5f)
+    };
+
+    test::Frame expected(width, height), frame(width, height);
+    for (auto const& position: positions) {
+        const glm::mat4 mvp = projection*rd::Camera(position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f))*
+                              glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(1.0f, 0.0f, 0.0f));
+
+        // A negligible projective term, which leaves w at one but rules
+        // out the affine path
+        glm::mat4 projective = mvp;
+        projective[0][3] = 1e-30f;
+
+        expected.clear();
+        const size_t rendered = rd::render(expected.color, expected.depth, model, projective, rd::shaders::normal);
+        CHECK(rendered > 0);
+        CHECK(expected.covered() > width*height/20);
+
+        frame.clear();
+        CHECK(rd::render(frame.color, frame.depth, model, mvp, rd::shaders::normal) == rendered);
+        CHECK(test::differences(frame, expected) == 0);
+        CHECK(depthError(frame, expected) < 1e-5f);
+
+        // Homogeneous scaling makes no difference either
+        frame.clear();
+        CHECK(rd::render(frame.color, frame.depth, model, 2.0f*mvp, rd::shaders::normal) == rendered);
+        CHECK(test::differences(frame, expected) == 0);
+    }
+
+    return test::result();
+}
@@ -0,0 +1,212 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+
+namespace rd = rendirt;
+
+namespace {
+    // Moller-Trumbore intersection, without culling: distance along ray,
+    // or a negative value if face is missed
+    float distance(rd::Ray const& ray, rd::Face const& face) {
+        const glm::vec3 edge1 = face.vertex[1] - face.vertex[0], edge2 = face.vertex[2] - face.vertex[0];
+        const glm::vec3 p = glm::cross(ray.direction, edge2);
+        const float det = glm::dot(edge1, p);
+        if (det == 0.0f)
+            return -1.0f;
+
+        const glm::vec3 s = ray.origin - face.vertex[0];
+        const float u = glm::dot(s, p)/det;
+        const glm::vec3 q = glm::cross(s, edge1);
+        const float v = glm::dot(ray.direction, q)/det;
+        if (u < 0.0f || v < 0.0f || u + v > 1.0f)
+            return -1.0f;
+
+        return glm::dot(edge2, q)/det;
+    }
+
+    // Closest face hit by ray, skipping faces of the culled winding as
+    // seen from the ray origin
+    rd::RayHit closest(rd::Model const& model, rd::Ray const& ray, rd::CullingMode cullingMode) {
+        rd::RayHit hit = { rd::RayHit::None, std::numeric_limits<float>::infinity(), glm::vec2(0.0f) };
+        for (size_t i = 0; i < model.size(); ++i) {
+            rd::Face const& face = model[i];
+            const float facing = glm::dot(glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]),
+                                          ray.direction);
+            if ((cullingMode == rd::CullCW && facing > 0.0f) || (cullingMode == rd::CullCCW && facing < 0.0f))
+                continue;
+
+            const float t = distance(ray, face);
+            if (t > 0.0f && t < hit.distance) {
+                hit.face = uint32_t(i);
+                hit.distance = t;
+            }
+        }
+
+        return hit;
+    }
+
+    bool occluded(rd::Model const& model, rd::Ray const& ray, float maxDistance) {
+        for (auto const& face: model) {
+            const float t = distance(ray, face);
+            if (t > 0.0f && t < maxDistance)
+                return true;
+        }
+
+        return false;
+    }
+} /* namespace */
+
+// Hierarchy queries agree with brute force over all faces
+int main() {
+    const rd::Model model = test::torus(24, 12);
+    std::mt19937 random(9);
+    std::normal_distribution<float> normal;
+    std::uniform_real_distribution<float> uniform(0.0f, 3.0f);
+
+    rd::BVH bvh;
+    bvh.build(model);
+    CHECK(bvh.size() == model.size());
+    CHECK(bvh.boundingBox().from == model.boundingBox().from);
+    CHECK(bvh.boundingBox().to == model.boundingBox().to);
+
+    // Every face appears once in leaf order
+    std::vector<int> seen(model.size(), 0);
+    for (size_t i = 0; i < bvh.size(); ++i)
+        ++seen[bvh.face(i)];
+    CHECK(std::count(seen.begin(), seen.end(), 1) == int(model.size()));
+
+    // Rays from random points around the torus, toward random points near
+    // it, some stopping short of the surface
+    std::vector<rd::Ray> rays;
+    std::vector<float> limits;
+    for (int i = 0; i < 800; ++i) {
+        const glm::vec3 origin = 1.5f*glm::vec3(normal(random), normal(random), 0.3f*normal(random));
+        const glm::vec3 target = glm::vec3(normal(random), normal(random), 0.2f*normal(random));
+        rays.push_back(rd::Ray{ origin, target - origin });
+        limits.push_back(uniform(random));
+    }
+
+    size_t mismatches = 0, hits = 0;
+    for (size_t i = 0; i < rays.size(); ++i) {
+        const bool expected = occluded(model, rays[i], limits[i]);
+        hits += expected;
+        mismatches += (bvh.occluded(rays[i], limits[i]) != expected);
+    }
+    CHECK(hits > rays.size()/10 && hits < rays.size()*9/10);
+    CHECK(mismatches == 0);
+
+    // Packets answer like single rays
+    mismatches = 0;
+    for (size_t i = 0; i + 8 <= rays.size(); i += 8) {
+        rd::Ray four[4], eight[8];
+        std::copy(rays.begin() + i, rays.begin() + i + 4, four);
+        std::copy(rays.begin() + i, rays.begin() + i + 8, eight);
+
+        const unsigned int four4 = bvh.occluded(four, 2.0f), eight8 = bvh.occluded(eight, 2.0f);
+        for (int k = 0; k < 8; ++k) {
+            const bool single = bvh.occluded(rays[i + k], 2.0f);
+            mismatches += (bool((eight8 >> k) & 1u) != single);
+            if (k < 4)
+                mismatches += (bool((four4 >> k) & 1u) != single);
+        }
+    }
+    CHECK(mismatches == 0);
+
+    // Closest hits, with either winding culled
+    const rd::CullingMode modes[] = { rd::CullNone, rd::CullCW, rd::CullCCW };
+    for (auto mode: modes) {
+        mismatches = 0;
+        for (auto const& ray: rays) {
+            const rd::RayHit expected = closest(model, ray, mode);
+            const rd::RayHit hit = bvh.intersect(ray, std::numeric_limits<float>::infinity(), mode);
+            if (bool(hit) != bool(expected)) {
+                ++mismatches;
+                continue;
+            }
+
+            if (!hit)
+                continue;
+
+            // Rays through shared edges may report either face
+            rd::Face const& face = model[hit.face];
+            const glm::vec3 point = face.vertex[0] + hit.barycentric.x*(face.vertex[1] - face.vertex[0]) +
+                                    hit.barycentric.y*(face.vertex[2] - face.vertex[0]);
+            mismatches += (std::abs(hit.distance - expected.distance) > 1e-4f*expected.distance ||
+                           glm::length(point - (ray.origin + hit.distance*ray.direction)) > 1e-4f);
+        }
+        CHECK(mismatches == 0);
+    }
+
+    // Packets answer like single rays, and the hierarchy built by several
+    // threads like the one built by one
+    rd::BVH serial;
+    serial.build(model, 1);
+    bvh.build(model, 4);
+    CHECK(serial.nodes().size() == bvh.nodes().size());
+
+    mismatches = 0;
+    for (size_t i = 0; i + 8 <= rays.size(); i += 8) {
+        rd::Ray four[4], eight[8];
+        std::copy(rays.begin() + i, rays.begin() + i + 4, four);
+        std::copy(rays.begin() + i, rays.begin() + i + 8, eight);
+
+        rd::RayHit fourHits[4], eightHits[8];
+        bvh.intersect(four, fourHits, 3.0f, rd::CullCW);
+        bvh.intersect(eight, eightHits, 3.0f, rd::CullCW);
+        for (int k = 0; k < 8; ++k) {
+            const rd::RayHit single = serial.intersect(rays[i + k], 3.0f, rd::CullCW);
+            mismatches += (eightHits[k].face != single.face || (single && eightHits[k].distance != single.distance));
+            if (k < 4)
+                mismatches += (fourHits[k].face != single.face || (single && fourHits[k].distance != single.distance));
+        }
+    }
+    CHECK(mismatches == 0);
+
+    // Baked occlusion: vertices on a convex box see the whole hemisphere,
+    // those in the corners of a room, with normals averaged toward its
+    // inside, see walls all around
+    const rd::Model box = test::box(rd::AABB{ glm::vec3(-1.0f), glm::vec3(1.0f) });
+    rd::IndexedMesh outside = rd::smoothNormals(box);
+    rd::BVH boxHierarchy;
+    boxHierarchy.build(box);
+    rd::bakeOcclusion(outside, boxHierarchy, 10.0f);
+    CHECK(outside.occlusion.size() == outside.vertices.size());
+    CHECK(*std::min_element(outside.occlusion.begin(), outside.occlusion.end()) > 0.99f);
+
+    const rd::Model room = test::box(rd::AABB{ glm::vec3(-1.0f), glm::vec3(1.0f) }, true);
+    rd::IndexedMesh inside(room);
+    rd::BVH roomHierarchy;
+    roomHierarchy.build(room);
+    rd::bakeOcclusion(inside, roomHierarchy, 10.0f);
+    CHECK(inside.occlusion.size() == 8);
+    CHECK(*std::max_element(inside.occlusion.begin(), inside.occlusion.end()) < 0.01f);
+
+    return test::result();
+}
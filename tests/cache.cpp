@@ -0,0 +1,87 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+#include "cache.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <set>
+
+// Hashing, and the on-disk store: hits, misses, replacement and eviction
+int main() {
+    // Hashes depend on every byte, the length and the seed
+    std::set<std::pair<std::uint64_t, std::uint64_t>> seen;
+    std::string data;
+    for (int length = 0; length < 100; ++length) {
+        cache::Hash h = cache::hash(data);
+        seen.insert(std::make_pair(h.lo, h.hi));
+        data.push_back(char(length % 3));
+    }
+    CHECK(seen.size() == 100);
+    CHECK(cache::hash(data) == cache::hash(std::string(data)));
+    CHECK(!(cache::hash(data) == cache::hash(data, 1)));
+    CHECK(!(cache::key(cache::hash(data), "64x64 tiff") == cache::key(cache::hash(data), "64x64 bmp")));
+
+    char dirTemplate[] = "/tmp/rendirt-cache-XXXXXX";
+    CHECK(::mkdtemp(dirTemplate) != nullptr);
+    const std::string dir = dirTemplate;
+
+    {
+        cache::Store store(dir, 1000);
+        const cache::Hash a = cache::hash("a"), b = cache::hash("b"), c = cache::hash("c");
+        std::string found;
+
+        CHECK(!store.find(a, found));
+        CHECK(store.store(a, std::string(400, 'a')));
+        CHECK(store.find(a, found) && found == std::string(400, 'a'));
+
+        // Replacing an entry does not count it twice
+        CHECK(store.store(a, std::string(300, 'A')));
+        CHECK(store.stats().size == 300);
+        CHECK(store.find(a, found) && found == std::string(300, 'A'));
+
+        // Going over the limit evicts the least recently used entry
+        ::usleep(20000);
+        CHECK(store.store(b, std::string(400, 'b')));
+        ::usleep(20000);
+        CHECK(store.store(c, std::string(400, 'c')));
+        CHECK(store.stats().evictions == 1);
+        CHECK(store.stats().size <= 1000);
+        CHECK(!store.find(a, found));
+        CHECK(store.find(b, found) && store.find(c, found));
+
+        // An entry that cannot be read or sized is a miss
+        const std::string hex = cache::hash("d").hex();
+        ::mkdir((dir + "/" + hex.substr(0, 2)).c_str(), 0777);
+        ::mkdir((dir + "/" + hex.substr(0, 2) + "/" + hex.substr(2)).c_str(), 0777);
+        CHECK(!store.find(cache::hash("d"), found));
+    }
+
+    CHECK(std::system(("rm -rf '" + dir + "'").c_str()) == 0);
+    return test::result();
+}
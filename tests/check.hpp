@@ -0,0 +1,208 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "rendirt.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Minimal support for behaviour tests: checks that report failures
+// without stopping, procedural meshes and render targets.
+namespace test {
+    namespace rd = rendirt;
+
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    inline void check(bool passed, char const* expr, char const* file, int line) {
+        if (!passed) {
+            std::cerr << file << ":" << line << ": check failed: " << expr << std::endl;
+            ++failures();
+        }
+    }
+
+    // Exit status for main()
+    inline int result() {
+        return failures() > 0 ? 1 : 0;
+    }
+
+    // Closed torus around the z axis, counter-clockwise when seen from outside
+    inline rd::Model torus(int rings = 48, int sides = 24, float radius = 1.0f, float thickness = 0.3f) {
+        // Indices wrap around, so that seam vertices are shared bitwise
+        auto point = [&](int i, int j) {
+            i %= rings;
+            j %= sides;
+            const float u = 2.0f*glm::pi<float>()*float(i)/float(rings);
+            const float v = 2.0f*glm::pi<float>()*float(j)/float(sides);
+            const float d = radius + thickness*std::cos(v);
+            return glm::vec3(d*std::cos(u), d*std::sin(u), thickness*std::sin(v));
+        };
+
+        rd::Model model;
+        for (int i = 0; i < rings; ++i) {
+            for (int j = 0; j < sides; ++j) {
+                const glm::vec3 a = point(i, j), b = point(i + 1, j), c = point(i + 1, j + 1), d = point(i, j + 1);
+                model.push_back(rd::Face{ glm::normalize(glm::cross(b - a, c - a)), { a, b, c } });
+                model.push_back(rd::Face{ glm::normalize(glm::cross(c - a, d - a)), { a, c, d } });
+            }
+        }
+
+        model.updateBoundingBox();
+        return model;
+    }
+
+    // Axis-aligned box, counter-clockwise when seen from outside; flipped
+    // faces toward the inside, e.g. for a room
+    inline rd::Model box(rd::AABB const& bounds, bool inward = false) {
+        rd::Model model;
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = 0; side < 2; ++side) {
+                const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                glm::vec3 corner[4];
+                for (int k = 0; k < 4; ++k) {
+                    corner[k][axis] = side ? bounds.to[axis] : bounds.from[axis];
+                    corner[k][u] = (k == 1 || k == 2) ? bounds.to[u] : bounds.from[u];
+                    corner[k][v] = (k >= 2) ? bounds.to[v] : bounds.from[v];
+                }
+
+                // (u, v, axis) is right-handed: the quad faces +axis
+                const bool flip = (side == 0) != inward;
+                const int order[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+                for (auto const& tri: order) {
+                    rd::Face face;
+                    for (int k = 0; k < 3; ++k)
+                        face.vertex[flip ? 2 - k : k] = corner[tri[k]];
+                    face.normal = glm::normalize(glm::cross(face.vertex[1] - face.vertex[0], face.vertex[2] - face.vertex[0]));
+                    model.push_back(face);
+                }
+            }
+        }
+
+        model.updateBoundingBox();
+        return model;
+    }
+
+    // Perspective or orthographic view of bounds from direction
+    inline glm::mat4 view(rd::AABB const& bounds, glm::vec3 const& direction, size_t width, size_t height,
+                          bool perspective = true)
+    {
+        const glm::vec3 center = (bounds.from + bounds.to)*0.5f;
+        const float radius = 0.5f*glm::length(bounds.to - bounds.from);
+        const glm::vec3 dir = glm::normalize(direction);
+        const glm::vec3 up = (std::abs(dir.y) > 0.99f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        const float aspect = float(width)/float(height);
+
+        const rd::Projection proj = perspective
+            ? rd::Projection(rd::Projection::Perspective, glm::radians(45.0f), float(width), float(height),
+                             0.5f*radius, 6.0f*radius)
+            : rd::Projection(rd::Projection::Orthographic, -aspect*radius, aspect*radius, -radius, radius,
+                             0.5f*radius, 6.0f*radius);
+
+        return proj*rd::Camera(center + 3.0f*radius*dir, center, up);
+    }
+
+    // Binary STL encoding of model. header starts the 80 byte header, padded
+    // with spaces: it must not look like the start of a text file
+    inline std::string binarySTL(rd::Model const& model, std::string const& header = "binary") {
+        std::string data(80, ' ');
+        data.replace(0, std::min<size_t>(header.size(), 80), header, 0, 80);
+
+        const uint32_t count = uint32_t(model.size());
+        data.append(reinterpret_cast<char const*>(&count), sizeof(count));
+        for (rd::Face const& face: model) {
+            data.append(reinterpret_cast<char const*>(&face), sizeof(rd::Face));
+            data.append(2, '\0');
+        }
+
+        return data;
+    }
+
+    // Text STL encoding of model
+    inline std::string textSTL(rd::Model const& model) {
+        std::ostringstream stream;
+        stream.precision(9);
+        stream << "solid test\n";
+        for (rd::Face const& face: model) {
+            stream << "facet normal " << face.normal.x << " " << face.normal.y << " " << face.normal.z << "\n"
+                   << "outer loop\n";
+            for (auto const& v: face.vertex)
+                stream << "vertex " << v.x << " " << v.y << " " << v.z << "\n";
+            stream << "endloop\nendfacet\n";
+        }
+        stream << "endsolid test\n";
+        return stream.str();
+    }
+
+    // Color and depth targets, cleared to black and far
+    struct Frame {
+        Frame(size_t width, size_t height)
+            : colors(width*height), depths(width*height),
+              color(colors.data(), width, height), depth(depths.data(), width, height)
+        {
+            clear();
+        }
+
+        Frame(Frame const&) = delete;
+        Frame& operator=(Frame const&) = delete;
+
+        void clear() {
+            color.clear(rd::Color(0, 0, 0, 255));
+            depth.clear(1.0f);
+        }
+
+        // Pixels not cleared by clear()
+        size_t covered() const {
+            size_t count = 0;
+            for (float z: depths)
+                count += (z < 1.0f);
+            return count;
+        }
+
+        std::vector<rd::Color> colors;
+        std::vector<float> depths;
+        rd::Image<rd::Color> color;
+        rd::Image<float> depth;
+    };
+
+    // Number of pixels whose colors differ
+    inline size_t differences(Frame const& a, Frame const& b) {
+        size_t count = 0;
+        for (size_t i = 0; i < a.colors.size(); ++i)
+            count += (a.colors[i] != b.colors[i]);
+        return count;
+    }
+} /* namespace test */
+
+#define CHECK(expr) test::check(bool(expr), #expr, __FILE__, __LINE__)
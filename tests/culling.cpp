@@ -0,0 +1,97 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+namespace {
+    size_t draw(rd::Model const& model, glm::mat4 const& mvp, rd::CullingMode cullingMode) {
+        test::Frame frame(64, 64);
+        return rd::render(frame.color, frame.depth, model, mvp, rd::shaders::normal, cullingMode);
+    }
+} /* namespace */
+
+// Faces are culled by their winding on screen, whatever the transform
+int main() {
+    // Counter-clockwise when seen from +z
+    rd::Model triangle;
+    triangle.push_back(rd::Face{ glm::vec3(0.0f, 0.0f, 1.0f),
+        { glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.5f, -0.5f, 0.0f), glm::vec3(0.0f, 0.5f, 0.0f) } });
+    triangle.updateBoundingBox();
+
+    const glm::mat4 cameras[] = {
+        rd::Camera(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+        rd::Camera(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f))
+    };
+
+    const glm::mat4 projections[] = {
+        rd::Projection(rd::Projection::Perspective, 1.0f, 64, 64, 0.5f, 10.0f),
+        rd::Projection(rd::Projection::Orthographic, -1.0f, 1.0f, -1.0f, 1.0f, 0.5f, 10.0f)
+    };
+
+    const glm::mat4 mirror = glm::scale(glm::mat4(1.0f), glm::vec3(-1.0f, 1.0f, 1.0f));
+
+    for (auto const& projection: projections) {
+        for (int c = 0; c < 2; ++c) {
+            // Seen from the front unless behind or mirrored (mirroring
+            // about x leaves the triangle facing the same way, with
+            // reversed winding)
+            for (int m = 0; m < 2; ++m) {
+                const glm::mat4 mvp = projection*cameras[c]*(m ? mirror : glm::mat4(1.0f));
+                const bool front = (c == 0) != (m == 1);
+
+                CHECK(draw(triangle, mvp, rd::CullNone) == 1);
+                CHECK(draw(triangle, mvp, rd::CullCW) == size_t(front));
+                CHECK(draw(triangle, mvp, rd::CullCCW) == size_t(!front));
+            }
+        }
+    }
+
+    // Culling a closed model leaves the image unchanged
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+    const glm::vec3 directions[] = {
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 2.0f, 0.5f), glm::vec3(-0.3f, -1.0f, -1.0f)
+    };
+
+    test::Frame expected(width, height), frame(width, height);
+    for (auto const& direction: directions) {
+        const glm::mat4 mvp = test::view(model.boundingBox(), direction, width, height);
+
+        expected.clear();
+        frame.clear();
+        rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal, rd::CullNone);
+        const size_t rendered = rd::render(frame.color, frame.depth, model, mvp, rd::shaders::normal, rd::CullCW);
+        CHECK(rendered < model.size()*3/4);
+
+        // Back faces seen edge-on may cover a few pixels on silhouettes,
+        // or win ties at equal depth there
+        CHECK(frame.covered() <= expected.covered());
+        CHECK(test::differences(frame, expected) <= expected.covered()/100);
+    }
+
+    return test::result();
+}
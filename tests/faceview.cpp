@@ -0,0 +1,75 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+// Strided, sliced and indexed views render like the faces they refer to
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+    const glm::mat4 mvp = test::view(model.boundingBox(), glm::vec3(1.0f, 2.0f, 3.0f), width, height);
+
+    test::Frame expected(width, height), frame(width, height);
+    const size_t rendered = rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+    CHECK(rendered > 0 && rendered < model.size());
+
+    // Records of a binary STL file, with normals recomputed
+    const std::string binary = test::binarySTL(model);
+    const rd::FaceView records = rd::FaceView::fromBinarySTL(binary.data(), binary.size());
+    CHECK(records.size() == model.size());
+    CHECK(rd::render(frame.color, frame.depth, records, mvp, rd::shaders::normal) == rendered);
+    CHECK(test::differences(frame, expected) == 0);
+
+    CHECK(rd::FaceView::fromBinarySTL(binary.data(), binary.size() - 1).empty());
+
+    // Consecutive slices
+    frame.clear();
+    const size_t half = model.size()/2;
+    rd::render(frame.color, frame.depth, rd::FaceView(model).slice(0, half), mvp, rd::shaders::normal);
+    rd::render(frame.color, frame.depth, rd::FaceView(model).slice(half, model.size() - half), mvp, rd::shaders::normal);
+    CHECK(test::differences(frame, expected) == 0);
+
+    // Every other face, by index, against a copy of those faces
+    std::vector<uint32_t> indices;
+    rd::Model even;
+    for (uint32_t i = 0; i < model.size(); i += 2) {
+        indices.push_back(i);
+        even.push_back(model[i]);
+    }
+
+    test::Frame subset(width, height);
+    frame.clear();
+    rd::render(subset.color, subset.depth, even, mvp, rd::shaders::normal);
+    rd::render(frame.color, frame.depth, rd::FaceView(model).indexed(indices.data(), indices.size()), mvp, rd::shaders::normal);
+    CHECK(test::differences(frame, subset) == 0);
+
+    // Slices of an indexed view select from the indices
+    const rd::FaceView tail = rd::FaceView(model).indexed(indices.data(), indices.size()).slice(1, 2);
+    CHECK(tail.size() == 2 && tail[1].vertex[0] == model[4].vertex[0]);
+
+    return test::result();
+}
@@ -0,0 +1,94 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace rd = rendirt;
+
+namespace {
+    // Faces of mesh as sorted vertex index triples, rotated to start from
+    // their smallest index
+    std::vector<std::array<uint32_t, 3>> faces(rd::IndexedMesh const& mesh) {
+        std::vector<std::array<uint32_t, 3>> result;
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            std::array<uint32_t, 3> face = {{ mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2] }};
+            std::rotate(face.begin(), std::min_element(face.begin(), face.end()), face.end());
+            result.push_back(face);
+        }
+
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+} /* namespace */
+
+// Indexed meshes render like the models they are built from
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+
+    rd::IndexedMesh mesh(model);
+    CHECK(mesh.size() == model.size());
+    CHECK(mesh.vertices.size() == 48*24);
+    CHECK(mesh.boundingBox.from == model.boundingBox().from);
+    CHECK(mesh.boundingBox.to == model.boundingBox().to);
+    CHECK(mesh.normals.empty() && mesh.occlusion.empty());
+
+    bool matching = true;
+    for (size_t i = 0; i < model.size(); ++i)
+        for (int k = 0; k < 3; ++k)
+            matching = matching && mesh.vertices[mesh.indices[3*i + k]] == model[i].vertex[k];
+    CHECK(matching);
+
+    rd::IndexedMesh optimized = mesh;
+    optimized.optimizeVertexCache();
+    CHECK(optimized.vertices == mesh.vertices);
+    CHECK(faces(optimized) == faces(mesh));
+
+    const glm::vec3 directions[] = {
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 2.0f, 0.5f), glm::vec3(-0.3f, -1.0f, -1.0f)
+    };
+
+    test::Frame expected(width, height), frame(width, height);
+    for (auto const& direction: directions) {
+        const glm::mat4 mvp = test::view(model.boundingBox(), direction, width, height);
+
+        expected.clear();
+        frame.clear();
+        const size_t rendered = rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+        CHECK(rd::render(frame.color, frame.depth, mesh, mvp, rd::shaders::normal) == rendered);
+        CHECK(test::differences(frame, expected) == 0);
+
+        // Faces meeting at equal depth on silhouettes are resolved in
+        // drawing order
+        frame.clear();
+        CHECK(rd::render(frame.color, frame.depth, optimized, mvp, rd::shaders::normal) == rendered);
+        CHECK(test::differences(frame, expected) <= expected.covered()/200);
+    }
+
+    return test::result();
+}
@@ -0,0 +1,97 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+namespace {
+    // Copy of model transformed by matrix, in the same orientation
+    rd::Model transformed(rd::Model const& model, glm::mat4 const& matrix) {
+        const bool mirrored = glm::determinant(glm::mat3(matrix)) < 0.0f;
+
+        rd::Model result;
+        for (auto const& face: model) {
+            rd::Face copy;
+            for (int i = 0; i < 3; ++i)
+                copy.vertex[i] = glm::vec3(matrix*glm::vec4(face.vertex[i], 1.0f));
+            if (mirrored)
+                std::swap(copy.vertex[1], copy.vertex[2]);
+            copy.normal = glm::normalize(glm::cross(copy.vertex[1] - copy.vertex[0], copy.vertex[2] - copy.vertex[0]));
+            result.push_back(copy);
+        }
+
+        result.updateBoundingBox();
+        return result;
+    }
+} /* namespace */
+
+// Instanced renders match renders of the flattened copies, mirrored included
+int main() {
+    const rd::Model model = test::torus(24, 12);
+    const size_t width = 200, height = 150;
+
+    std::vector<glm::mat4> instances;
+    rd::Model flat;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f*i - 4.5f, 0.0f, 3.0f*j - 4.5f));
+            matrix = glm::rotate(matrix, 0.4f*float(i + j), glm::vec3(1.0f, 0.0f, 0.0f));
+            if ((i + j) % 3 == 0)
+                matrix = glm::scale(matrix, glm::vec3(-1.0f, 1.0f, 1.0f));
+
+            instances.push_back(matrix);
+            for (auto const& face: transformed(model, matrix))
+                flat.push_back(face);
+        }
+    }
+    flat.updateBoundingBox();
+
+    const glm::mat4 viewProj = test::view(flat.boundingBox(), glm::vec3(0.3f, 1.0f, 0.8f), width, height);
+
+    test::Frame expected(width, height), frame(width, height);
+    rd::render(expected.color, expected.depth, flat, viewProj, rd::shaders::normal);
+    const size_t rendered = rd::render(frame.color, frame.depth, model, instances.data(), instances.size(),
+                                       viewProj, rd::shaders::normal);
+
+    CHECK(rendered > 0);
+    CHECK(expected.covered() > width*height/20);
+    CHECK(test::differences(frame, expected) == 0);
+
+    // A mirrored instance alone keeps its outward faces
+    test::Frame single(width, height), mirrored(width, height);
+    rd::render(single.color, single.depth, transformed(model, instances[0]), viewProj, rd::shaders::normal);
+    rd::render(mirrored.color, mirrored.depth, model, instances.data(), 1, viewProj, rd::shaders::normal);
+    CHECK(single.covered() > 0);
+    CHECK(test::differences(mirrored, single) == 0);
+
+    // Instances outside the view are skipped
+    const glm::mat4 away = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1000.0f, 0.0f));
+    frame.clear();
+    CHECK(rd::render(frame.color, frame.depth, model, &away, 1, viewProj, rd::shaders::normal) == 0);
+    CHECK(frame.covered() == 0);
+
+    return test::result();
+}
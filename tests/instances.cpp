@@ -0,0 +1,102 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace rd = rendirt;
+
+// Rigid copies are found whatever their face and vertex order, and the
+// instanced model renders like the original one
+int main() {
+    const rd::Model torus = test::torus(24, 12);
+    const rd::Model box = test::box(rd::AABB{ glm::vec3(-7.0f, -1.0f, -1.0f), glm::vec3(-5.0f, 1.0f, 1.0f) });
+    std::mt19937 random(7);
+
+    rd::Model model;
+    const int copies = 5;
+    for (int n = 0; n < copies; ++n) {
+        glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f*n, 0.0f, 0.0f));
+        matrix = glm::rotate(matrix, 0.7f*float(n), glm::normalize(glm::vec3(1.0f, 2.0f, 0.5f)));
+
+        rd::Model copy;
+        for (auto const& face: torus) {
+            rd::Face moved;
+            const int first = int(random() % 3);
+            for (int k = 0; k < 3; ++k)
+                moved.vertex[k] = glm::vec3(matrix*glm::vec4(face.vertex[(first + k) % 3], 1.0f));
+            moved.normal = glm::normalize(glm::cross(moved.vertex[1] - moved.vertex[0], moved.vertex[2] - moved.vertex[0]));
+            copy.push_back(moved);
+        }
+
+        std::shuffle(copy.begin(), copy.end(), random);
+        model.insert(model.end(), copy.begin(), copy.end());
+    }
+    model.insert(model.end(), box.begin(), box.end());
+    model.updateBoundingBox();
+
+    const rd::InstancedModel instanced = rd::findInstances(model);
+    CHECK(instanced.meshes.size() == 2);
+    CHECK(instanced.faceCount() == torus.size() + box.size());
+    CHECK(instanced.instancedFaceCount() == model.size());
+
+    size_t repeated = 0;
+    for (auto const& mesh: instanced.meshes) {
+        if (mesh.instances.size() == size_t(copies) && mesh.model.size() == torus.size())
+            ++repeated;
+        else
+            CHECK(mesh.instances.size() == 1 && mesh.model.size() == box.size());
+    }
+    CHECK(repeated == 1);
+
+    const size_t width = 200, height = 150;
+    const glm::mat4 viewProj = test::view(model.boundingBox(), glm::vec3(0.2f, 1.0f, 0.7f), width, height);
+
+    test::Frame expected(width, height), frame(width, height);
+    rd::render(expected.color, expected.depth, model, viewProj, rd::shaders::normal);
+    for (auto const& mesh: instanced.meshes)
+        rd::render(frame.color, frame.depth, mesh.model, mesh.instances.data(), mesh.instances.size(),
+                   viewProj, rd::shaders::normal);
+
+    // Recovered transforms are exact up to rounding, which may move a few
+    // edge pixels
+    CHECK(expected.covered() > width*height/100);
+    CHECK(test::differences(frame, expected) <= expected.covered()/100);
+
+    // A copy that is not rigid stays apart
+    rd::Model stretched = model;
+    for (size_t i = 0; i < torus.size(); ++i)
+        for (auto& vertex: stretched[i].vertex)
+            vertex.y *= 1.5f;
+
+    const rd::InstancedModel partial = rd::findInstances(stretched);
+    CHECK(partial.instancedFaceCount() == model.size());
+    CHECK(partial.faceCount() < model.size());
+    CHECK(partial.faceCount() > torus.size() + box.size());
+
+    return test::result();
+}
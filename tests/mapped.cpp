@@ -0,0 +1,82 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+#include "mapped.hpp"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace rd = rendirt;
+
+namespace {
+    void write(std::string const& path, std::string const& data) {
+        std::ofstream file(path, std::ofstream::binary);
+        file.write(data.data(), data.size());
+    }
+} /* namespace */
+
+// Which files are mapped, and rendering them in chunks as in memory
+int main() {
+    const rd::Model model = test::torus();
+    const std::string path = "/tmp/rendirt-mapped-" + std::to_string(::getpid()) + ".stl";
+    mapped::MappedSTL stl;
+
+    // Binary files are mapped, even when their header starts with "solid"
+    write(path, test::binarySTL(model, "solid exported by some CAD program"));
+    CHECK(stl.open(path));
+    CHECK(stl.size() == model.size());
+
+    const rd::AABB box = mapped::boundingBox(stl, 100);
+    CHECK(box.from == model.boundingBox().from && box.to == model.boundingBox().to);
+
+    // Chunked rendering matches rendering the model from memory
+    const size_t width = 160, height = 120;
+    const glm::mat4 mvp = test::view(model.boundingBox(), glm::vec3(1.0f, 2.0f, 3.0f), width, height);
+    test::Frame mapped(width, height), loaded(width, height);
+    CHECK(mapped::render(mapped.color, mapped.depth, stl, mvp, rd::shaders::normal, rd::CullCW, 100) ==
+          rd::render(loaded.color, loaded.depth, model, mvp, rd::shaders::normal));
+    CHECK(test::differences(mapped, loaded) == 0);
+    CHECK(mapped.covered() > 0);
+    stl.close();
+
+    // Trailing data, truncated files and text files are refused
+    write(path, test::binarySTL(model) + "trailer");
+    CHECK(!stl.open(path) && errno == EINVAL);
+
+    const std::string binary = test::binarySTL(model);
+    write(path, binary.substr(0, binary.size() - 1));
+    CHECK(!stl.open(path) && errno == EINVAL);
+
+    write(path, test::textSTL(model));
+    CHECK(!stl.open(path) && errno == EINVAL);
+
+    CHECK(!stl.open(path + ".missing"));
+
+    std::remove(path.c_str());
+    return test::result();
+}
@@ -0,0 +1,71 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <sstream>
+
+namespace rd = rendirt;
+
+// Loading STL data, and reusing a model's storage across loads
+int main() {
+    const rd::Model source = test::torus();
+    const std::string binary = test::binarySTL(source), text = test::textSTL(source);
+
+    rd::Model model;
+    std::istringstream binaryStream(binary);
+    CHECK(model.loadSTL(binaryStream) == rd::Model::Ok);
+    CHECK(model.size() == source.size());
+    CHECK(model.back().vertex[2] == source.back().vertex[2]);
+    CHECK(model.boundingBox().from == source.boundingBox().from);
+    CHECK(model.boundingBox().to == source.boundingBox().to);
+
+    // Loading a smaller model keeps the buffer
+    const rd::Face* storage = model.data();
+    const rd::Model cube = test::box(rd::AABB{ glm::vec3(-1.0f), glm::vec3(1.0f) });
+    std::istringstream cubeStream(test::binarySTL(cube));
+    CHECK(model.loadSTL(cubeStream) == rd::Model::Ok);
+    CHECK(model.size() == cube.size());
+    CHECK(model.data() == storage);
+    CHECK(model.boundingBox().to == glm::vec3(1.0f));
+
+    std::istringstream textStream(text);
+    CHECK(model.loadSTL(textStream) == rd::Model::Ok);
+    CHECK(model.size() == source.size());
+    CHECK(model.data() == storage);
+    CHECK(glm::all(glm::lessThan(glm::abs(model.boundingBox().to - source.boundingBox().to), glm::vec3(1e-6f))));
+
+    // An empty text model has an empty bounding box, not the previous one
+    std::istringstream emptyStream("solid empty\nendsolid empty\n");
+    CHECK(model.loadSTL(emptyStream) == rd::Model::Ok);
+    CHECK(model.empty());
+    CHECK(model.boundingBox().to == glm::vec3(0.0f));
+
+    // Truncated binary data is reported
+    std::istringstream truncated(binary.substr(0, binary.size() - 10));
+    CHECK(model.loadSTL(truncated) == rd::Model::FileTruncated);
+
+    return test::result();
+}
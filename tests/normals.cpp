@@ -0,0 +1,90 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+
+namespace rd = rendirt;
+
+// Smooth normals follow curved surfaces and split on creases
+int main() {
+    const rd::Model torus = test::torus();
+
+    const rd::IndexedMesh mesh = rd::smoothNormals(torus);
+    CHECK(mesh.size() == torus.size());
+    CHECK(mesh.vertices.size() == 48*24);
+    CHECK(mesh.normals.size() == mesh.vertices.size());
+
+    // Normals point away from the circle at the center of the tube
+    float error = 0.0f;
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        const glm::vec3 p = mesh.vertices[v];
+        const glm::vec3 center = glm::normalize(glm::vec3(p.x, p.y, 0.0f));
+        error = std::max(error, glm::length(mesh.normals[v].unpack() - glm::normalize(p - center)));
+    }
+    CHECK(error < 0.01f);
+
+    // The same mesh with either weighting and any number of threads
+    const rd::IndexedMesh serial = rd::smoothNormals(torus, glm::radians(45.0f), rd::WeightByAngle, 1e-5f, 1);
+    const rd::IndexedMesh parallel = rd::smoothNormals(torus, glm::radians(45.0f), rd::WeightByAngle, 1e-5f, 4);
+    CHECK(serial.vertices == parallel.vertices);
+    CHECK(serial.indices == parallel.indices);
+    CHECK(serial.normals == parallel.normals);
+
+    const rd::IndexedMesh byArea = rd::smoothNormals(torus, glm::radians(45.0f), rd::WeightByArea);
+    CHECK(byArea.vertices.size() == mesh.vertices.size());
+
+    // Box corners are split into one vertex per side, with the normal of
+    // that side, unless the crease angle is wider than a right angle
+    const rd::Model box = test::box(rd::AABB{ glm::vec3(-1.0f), glm::vec3(1.0f) });
+    const rd::IndexedMesh creased = rd::smoothNormals(box);
+    CHECK(creased.vertices.size() == 24);
+
+    bool flat = true;
+    for (size_t i = 0; i < creased.indices.size(); ++i) {
+        const glm::vec3 normal = box[i/3].normal;
+        flat = flat && glm::length(creased.normals[creased.indices[i]].unpack() - normal) < 1e-3f;
+    }
+    CHECK(flat);
+
+    const rd::IndexedMesh rounded = rd::smoothNormals(box, glm::radians(120.0f));
+    CHECK(rounded.vertices.size() == 8);
+
+    bool diagonal = true;
+    for (size_t v = 0; v < rounded.vertices.size(); ++v)
+        diagonal = diagonal && glm::length(rounded.normals[v].unpack() - glm::normalize(rounded.vertices[v])) < 1e-3f;
+    CHECK(diagonal);
+
+    // Nearly equal vertices are welded within the tolerance
+    rd::Model shifted = torus;
+    for (size_t i = 0; i < shifted.size(); i += 2)
+        shifted[i].vertex[0] += glm::vec3(1e-6f);
+
+    CHECK(rd::smoothNormals(shifted).vertices.size() == 48*24);
+    CHECK(rd::smoothNormals(shifted, glm::radians(45.0f), rd::WeightByAngle, 0.0f).vertices.size() > 48*24);
+
+    return test::result();
+}
@@ -0,0 +1,97 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+namespace {
+    // Index of the pixel where point lands
+    size_t pixel(glm::mat4 const& mvp, glm::vec3 const& point, size_t width, size_t height) {
+        const glm::vec4 clip = mvp*glm::vec4(point, 1.0f);
+        const glm::vec2 ndc = glm::vec2(clip)/clip.w;
+        const size_t x = size_t((ndc.x*0.5f + 0.5f)*float(width));
+        const size_t y = size_t((0.5f - ndc.y*0.5f)*float(height));
+        return y*width + x;
+    }
+} /* namespace */
+
+// Open surfaces stay lit, inside corners get darker
+int main() {
+    // A block standing on a floor
+    rd::Model scene = test::box(rd::AABB{ glm::vec3(-4.0f, -1.0f, -4.0f), glm::vec3(4.0f, 0.0f, 4.0f) });
+    const rd::Model block = test::box(rd::AABB{ glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 2.0f, 1.0f) });
+    scene.insert(scene.end(), block.begin(), block.end());
+    scene.updateBoundingBox();
+
+    const size_t width = 200, height = 150;
+    const glm::mat4 mvp = test::view(scene.boundingBox(), glm::vec3(0.6f, 0.8f, 1.0f), width, height);
+
+    test::Frame frame(width, height);
+    rd::render(frame.color, frame.depth, scene, mvp, rd::shaders::normal);
+
+    std::vector<float> values(width*height, -1.0f);
+    const rd::Image<float> occlusion(values.data(), width, height);
+    rd::ambientOcclusion(occlusion, frame.depth, mvp, 0.5f, 1);
+
+    bool inRange = true, background = true;
+    for (size_t i = 0; i < values.size(); ++i) {
+        inRange = inRange && values[i] >= 0.0f && values[i] <= 1.0f;
+        if (frame.depths[i] == 1.0f)
+            background = background && values[i] == 1.0f;
+    }
+    CHECK(inRange);
+    CHECK(background);
+
+    const float open = values[pixel(mvp, glm::vec3(3.0f, 0.0f, 3.0f), width, height)];
+    const float top = values[pixel(mvp, glm::vec3(0.0f, 2.0f, 0.0f), width, height)];
+    const float corner = values[pixel(mvp, glm::vec3(1.05f, 0.0f, 1.05f), width, height)];
+    CHECK(open > 0.9f);
+    CHECK(top > 0.9f);
+    CHECK(corner < open - 0.05f);
+
+    // Threads split the work, not the result
+    std::vector<float> parallel(width*height);
+    rd::ambientOcclusion(rd::Image<float>(parallel.data(), width, height), frame.depth, mvp, 0.5f, 4);
+    CHECK(parallel == values);
+
+    // Colors are darkened by occlusion, scaled by strength
+    test::Frame darkened(width, height);
+    darkened.colors = frame.colors;
+    darkened.depths = frame.depths;
+    rd::ambientOcclusion(darkened.color, darkened.depth, mvp, 0.5f, 0.0f);
+    CHECK(test::differences(darkened, frame) == 0);
+
+    rd::ambientOcclusion(darkened.color, darkened.depth, mvp, 0.5f, 1.0f);
+    const size_t i = pixel(mvp, glm::vec3(1.05f, 0.0f, 1.05f), width, height);
+    CHECK(darkened.colors[i].g < frame.colors[i].g);
+
+    bool darker = true;
+    for (size_t p = 0; p < darkened.colors.size(); ++p)
+        darker = darker && glm::all(glm::lessThanEqual(glm::vec3(darkened.colors[p]), glm::vec3(frame.colors[p])));
+    CHECK(darker);
+
+    return test::result();
+}
@@ -0,0 +1,147 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <tuple>
+
+namespace rd = rendirt;
+
+namespace {
+    // Faces in a canonical order, for comparing permutations
+    std::vector<std::vector<float>> sorted(rd::Model const& model) {
+        std::vector<std::vector<float>> faces;
+        for (auto const& face: model) {
+            std::vector<float> values;
+            for (auto const& vertex: face.vertex)
+                values.insert(values.end(), { vertex.x, vertex.y, vertex.z });
+            faces.push_back(values);
+        }
+
+        std::sort(faces.begin(), faces.end());
+        return faces;
+    }
+
+    // Misses of a FIFO vertex cache with size entries, per face
+    float missRatio(rd::Model const& model, size_t size) {
+        std::deque<std::tuple<float, float, float>> cache;
+        size_t misses = 0;
+
+        for (auto const& face: model) {
+            for (auto const& vertex: face.vertex) {
+                const auto key = std::make_tuple(vertex.x, vertex.y, vertex.z);
+                if (std::find(cache.begin(), cache.end(), key) != cache.end())
+                    continue;
+
+                ++misses;
+                cache.push_back(key);
+                if (cache.size() > size)
+                    cache.pop_front();
+            }
+        }
+
+        return float(misses)/float(model.size());
+    }
+
+    // Mean distance between the centroids of consecutive faces
+    float meanStep(rd::Model const& model) {
+        float total = 0.0f;
+        for (size_t i = 1; i < model.size(); ++i) {
+            const glm::vec3 a = model[i - 1].vertex[0] + model[i - 1].vertex[1] + model[i - 1].vertex[2];
+            const glm::vec3 b = model[i].vertex[0] + model[i].vertex[1] + model[i].vertex[2];
+            total += glm::length(b - a)/3.0f;
+        }
+
+        return total/float(model.size() - 1);
+    }
+
+    bool rendersEqual(rd::Model const& a, rd::Model const& b) {
+        const size_t width = 160, height = 120;
+        const glm::vec3 directions[] = {
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 2.0f, 0.5f), glm::vec3(-0.3f, -1.0f, -1.0f)
+        };
+
+        test::Frame first(width, height), second(width, height);
+        for (auto const& direction: directions) {
+            const glm::mat4 mvp = test::view(a.boundingBox(), direction, width, height);
+            first.clear();
+            second.clear();
+            rd::render(first.color, first.depth, a, mvp, rd::shaders::normal);
+            rd::render(second.color, second.depth, b, mvp, rd::shaders::normal);
+            // Faces meeting at equal depth on silhouettes are resolved in
+            // drawing order
+            if (test::differences(first, second) > first.covered()/200)
+                return false;
+        }
+
+        return true;
+    }
+} /* namespace */
+
+// Reordered models hold the same faces and render the same
+int main() {
+    rd::Model model = test::torus();
+    std::mt19937 random(11);
+    std::shuffle(model.begin(), model.end(), random);
+
+    rd::Model optimized = model;
+    rd::optimizeFaceOrder(optimized);
+    CHECK(sorted(optimized) == sorted(model));
+    CHECK(optimized.boundingBox().from == model.boundingBox().from);
+    CHECK(optimized.boundingBox().to == model.boundingBox().to);
+    CHECK(rendersEqual(optimized, model));
+
+    // Shuffled faces miss on nearly every vertex. Fewer clusters keep
+    // more of the locality of Tipsify
+    rd::Model local = model;
+    rd::optimizeFaceOrder(local, 16, 0.0f);
+    CHECK(missRatio(optimized, 16) < missRatio(model, 16));
+    CHECK(missRatio(local, 16) < 0.5f*missRatio(model, 16));
+    CHECK(missRatio(local, 16) <= missRatio(optimized, 16));
+    CHECK(sorted(local) == sorted(model));
+
+    // Morton order, whatever the number of threads
+    rd::Model morton = model, serial = model;
+    rd::sortFacesMorton(morton, 4);
+    rd::sortFacesMorton(serial, 1);
+    CHECK(sorted(morton) == sorted(model));
+    CHECK(rendersEqual(morton, model));
+    CHECK(meanStep(morton) < 0.25f*meanStep(model));
+
+    bool same = true;
+    for (size_t i = 0; i < model.size(); ++i)
+        same = same && morton[i].vertex[0] == serial[i].vertex[0];
+    CHECK(same);
+
+    rd::Model empty;
+    rd::optimizeFaceOrder(empty);
+    rd::sortFacesMorton(empty);
+    CHECK(empty.empty());
+
+    return test::result();
+}
@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+// Face ids name the faces seen at each pixel, also through scissor windows
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+    const glm::mat4 mvp = test::view(model.boundingBox(), glm::vec3(1.0f, 2.0f, 0.5f), width, height);
+
+    test::Frame expected(width, height), frame(width, height);
+    rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+
+    std::vector<uint32_t> idBuffer(width*height, rd::RayHit::None);
+    const rd::Image<uint32_t> ids(idBuffer.data(), width, height);
+    rd::render(ids, frame.depth, model, mvp);
+    CHECK(frame.depths == expected.depths);
+
+    // Each id is that of a face covering the pixel: drawn alone, it shades
+    // the pixel with the color seen there
+    bool covered = true, matching = true;
+    for (size_t i = 0; i < idBuffer.size(); ++i) {
+        covered = covered && ((idBuffer[i] != rd::RayHit::None) == (expected.depths[i] < 1.0f));
+        if (idBuffer[i] == rd::RayHit::None || i % 7)
+            continue;
+
+        test::Frame single(width, height);
+        rd::render(single.color, single.depth, &model[idBuffer[i]], 1, mvp, rd::shaders::normal);
+        matching = matching && single.colors[i] == expected.colors[i] && single.depths[i] == expected.depths[i];
+    }
+    CHECK(covered);
+    CHECK(matching);
+
+    // Ray-cast ids agree but on silhouettes and shared edges
+    rd::BVH bvh;
+    bvh.build(model);
+    std::vector<uint32_t> castBuffer(width*height, rd::RayHit::None);
+    frame.clear();
+    rd::render(rd::Image<uint32_t>(castBuffer.data(), width, height), frame.depth, bvh, mvp);
+
+    size_t disagreements = 0;
+    for (size_t i = 0; i < idBuffer.size(); ++i)
+        disagreements += (castBuffer[i] != idBuffer[i]);
+    CHECK(disagreements <= expected.covered()/50);
+
+    // A scissor window renders the same pixels as the whole view
+    const size_t x0 = 70, y0 = 20, w = 24, h = 16;
+    const glm::mat4 scissor = rd::scissorMatrix(x0, y0, w, h, width, height);
+
+    std::vector<uint32_t> windowBuffer(w*h, rd::RayHit::None);
+    test::Frame window(w, h);
+    rd::render(rd::Image<uint32_t>(windowBuffer.data(), w, h), window.depth, model, scissor*mvp);
+
+    size_t mismatches = 0, hits = 0;
+    for (size_t y = 0; y < h; ++y) {
+        for (size_t x = 0; x < w; ++x) {
+            hits += (windowBuffer[y*w + x] != rd::RayHit::None);
+            mismatches += (windowBuffer[y*w + x] != idBuffer[(y0 + y)*width + x0 + x]);
+        }
+    }
+    CHECK(hits > 0 && hits < w*h);
+    CHECK(mismatches == 0);
+
+    window.clear();
+    rd::render(window.color, window.depth, model, scissor*mvp, rd::shaders::normal);
+    mismatches = 0;
+    for (size_t y = 0; y < h; ++y)
+        for (size_t x = 0; x < w; ++x)
+            mismatches += (window.colors[y*w + x] != expected.colors[(y0 + y)*width + x0 + x]);
+    CHECK(mismatches == 0);
+
+    return test::result();
+}
@@ -0,0 +1,79 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <random>
+
+namespace rd = rendirt;
+
+// Renders of the potentially visible faces match renders of all faces
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 160;
+
+    rd::VisibilitySets sets;
+    sets.build(model);
+    CHECK(sets.bucketCount() == 6*2*2);
+
+    size_t largest = 0;
+    for (size_t b = 0; b < sets.bucketCount(); ++b) {
+        largest = std::max(largest, sets.faces(b).size());
+        for (uint32_t face: sets.faces(b))
+            CHECK(face < model.size());
+    }
+    CHECK(largest > 0 && largest < model.size());
+
+    std::mt19937 random(3);
+    std::normal_distribution<float> normal;
+    std::vector<uint32_t> selection, other;
+
+    test::Frame expected(width, height), frame(width, height);
+    size_t selected = 0;
+    const int views = 40;
+    for (int n = 0; n < views; ++n) {
+        const glm::vec3 direction = glm::normalize(glm::vec3(normal(random), normal(random), normal(random)));
+        const glm::mat4 mvp = test::view(model.boundingBox(), direction, width, height);
+
+        // The second selection must not disturb the first
+        const rd::FaceView faces = sets.select(model, mvp, selection);
+        sets.select(model, test::view(model.boundingBox(), -direction, width, height), other);
+        selected += faces.size();
+
+        expected.clear();
+        frame.clear();
+        rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+        rd::render(frame.color, frame.depth, faces, mvp, rd::shaders::normal);
+        CHECK(test::differences(frame, expected) == 0);
+    }
+    CHECK(selected < views*model.size());
+
+    // From inside the bounding box every face may be visible
+    const glm::mat4 inside = rd::Projection(rd::Projection::Perspective, 1.2f, width, height, 0.01f, 10.0f)*
+                             rd::Camera(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    CHECK(sets.select(model, inside, selection).size() == model.size());
+
+    return test::result();
+}
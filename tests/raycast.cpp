@@ -0,0 +1,93 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rd = rendirt;
+
+// Ray-cast renders match rasterized ones up to rounding
+int main() {
+    const rd::Model model = test::torus();
+    const size_t width = 160, height = 120;
+
+    rd::BVH bvh;
+    bvh.build(model);
+
+    const glm::mat4 views[] = {
+        test::view(model.boundingBox(), glm::vec3(0.0f, 0.0f, 1.0f), width, height),
+        test::view(model.boundingBox(), glm::vec3(1.0f, 2.0f, 0.5f), width, height),
+        rd::Projection(rd::Projection::Orthographic, -2.0f, 2.0f, -1.5f, 1.5f, 0.5f, 10.0f)*
+            rd::Camera(glm::vec3(1.0f, -3.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f))
+    };
+
+    test::Frame expected(width, height), frame(width, height), parallel(width, height);
+    for (auto const& mvp: views) {
+        for (auto mode: { rd::CullCW, rd::CullNone }) {
+            expected.clear();
+            frame.clear();
+            rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal, mode);
+            const size_t shaded = rd::render(frame.color, frame.depth, model, bvh, mvp, rd::shaders::normal, mode, 1);
+
+            CHECK(expected.covered() > width*height/20);
+            CHECK(shaded == frame.covered());
+
+            // Pixel centers on silhouettes may fall on either side
+            const size_t coverage = std::max(frame.covered(), expected.covered()) -
+                                    std::min(frame.covered(), expected.covered());
+            CHECK(coverage <= expected.covered()/100);
+            CHECK(test::differences(frame, expected) <= expected.covered()/50);
+
+            size_t depths = 0;
+            for (size_t i = 0; i < frame.depths.size(); ++i)
+                depths += (std::abs(frame.depths[i] - expected.depths[i]) > 1e-4f);
+            CHECK(depths <= expected.covered()/50);
+
+            parallel.clear();
+            rd::render(parallel.color, parallel.depth, model, bvh, mvp, rd::shaders::normal, mode, 4);
+            CHECK(test::differences(parallel, frame) == 0);
+            CHECK(parallel.depths == frame.depths);
+        }
+    }
+
+    // Ray casting pays off for many faces in few pixels, and once the
+    // hierarchy exists
+    CHECK(rd::preferRayCasting(10000000, 64, 64, true));
+    CHECK(!rd::preferRayCasting(1000, 1920, 1080, true));
+    CHECK(!rd::preferRayCasting(1000000, 256, 256, false));
+    CHECK(rd::preferRayCasting(1000000, 256, 256, true));
+
+    rd::RenderCosts costlyPixels;
+    costlyPixels.pixel = 1000.0;
+    CHECK(rd::preferRayCasting(1000, 1920, 1080, true, costlyPixels));
+
+    rd::RenderCosts costlyFaces;
+    costlyFaces.face = 1e6;
+    CHECK(rd::preferRayCasting(1000, 1920, 1080, true, costlyFaces));
+
+    return test::result();
+}
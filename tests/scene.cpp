@@ -0,0 +1,92 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+// Scene renders match renders of the flattened objects
+int main() {
+    const rd::Model torus = test::torus(24, 12);
+    const rd::Model box = test::box(rd::AABB{ glm::vec3(-0.5f), glm::vec3(0.5f) });
+    const size_t width = 200, height = 150;
+
+    rd::Scene scene;
+    rd::Model flat;
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < 5; ++j) {
+            rd::Model const& model = ((i + j) % 2) ? box : torus;
+            glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f*i - 6.0f, 0.5f*j, -3.0f*j));
+            matrix = glm::rotate(matrix, 0.3f*float(i*j), glm::vec3(0.0f, 1.0f, 1.0f));
+
+            scene.add(model, matrix);
+            for (auto const& face: model) {
+                rd::Face copy;
+                for (int k = 0; k < 3; ++k)
+                    copy.vertex[k] = glm::vec3(matrix*glm::vec4(face.vertex[k], 1.0f));
+                copy.normal = glm::normalize(glm::cross(copy.vertex[1] - copy.vertex[0], copy.vertex[2] - copy.vertex[0]));
+                flat.push_back(copy);
+            }
+        }
+    }
+    flat.updateBoundingBox();
+
+    CHECK(!scene.built());
+    scene.build();
+    CHECK(scene.built() && scene.size() == 25);
+
+    const rd::AABB bounds = scene.boundingBox();
+    CHECK(glm::all(glm::lessThanEqual(bounds.from, flat.boundingBox().from + 1e-4f)));
+    CHECK(glm::all(glm::greaterThanEqual(bounds.to, flat.boundingBox().to - 1e-4f)));
+
+    test::Frame expected(width, height), frame(width, height);
+
+    // Whole scene in view, then a close view that leaves most objects out
+    const glm::vec3 directions[] = { glm::vec3(0.2f, 1.0f, 1.0f), glm::vec3(-1.0f, 0.3f, 0.5f) };
+    for (auto const& direction: directions) {
+        const glm::mat4 viewProj = test::view(flat.boundingBox(), direction, width, height);
+
+        expected.clear();
+        frame.clear();
+        const size_t all = rd::render(expected.color, expected.depth, flat, viewProj, rd::shaders::normal);
+        const size_t rendered = rd::render(frame.color, frame.depth, scene, viewProj, rd::shaders::normal);
+        CHECK(rendered == all);
+        CHECK(expected.covered() > 0);
+        CHECK(test::differences(frame, expected) == 0);
+    }
+
+    // Faces crossing the plane of the viewer are not clipped, so the
+    // close view looks into the scene from its edge
+    const glm::mat4 closeUp = test::view(scene[0].bounds, glm::vec3(-1.0f, 0.3f, 0.2f), width, height);
+    expected.clear();
+    frame.clear();
+    rd::render(expected.color, expected.depth, flat, closeUp, rd::shaders::normal);
+    const size_t rendered = rd::render(frame.color, frame.depth, scene, closeUp, rd::shaders::normal);
+    CHECK(rendered < flat.size()/2);
+    CHECK(expected.covered() > 0);
+    CHECK(test::differences(frame, expected) == 0);
+
+    return test::result();
+}
@@ -0,0 +1,109 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace rd = rendirt;
+
+namespace {
+    int channelError(rd::Color const& a, rd::Color const& b) {
+        const glm::ivec4 d = glm::abs(glm::ivec4(a) - glm::ivec4(b));
+        return std::max(std::max(d.x, d.y), std::max(d.z, d.w));
+    }
+} /* namespace */
+
+// Packed normals, normal tables and the lighting shaders built on them
+int main() {
+    std::mt19937 random(5);
+    std::normal_distribution<float> normal;
+    std::vector<glm::vec3> directions;
+    for (int i = 0; i < 2000; ++i)
+        directions.push_back(glm::normalize(glm::vec3(normal(random), normal(random), normal(random))));
+    directions.push_back(glm::vec3(0.0f, 0.0f, -1.0f));
+    directions.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
+
+    // 16 bits per coordinate keep unit vectors within 1e-4
+    float error = 0.0f;
+    for (auto const& direction: directions)
+        error = std::max(error, glm::length(rd::PackedNormal(direction).unpack() - direction));
+    CHECK(error < 1e-4f);
+
+    // Tables return a color computed for a nearby normal
+    const auto encode = [](glm::vec3 n) {
+        return rd::Color(glm::round(127.5f*(n + 1.0f)), 255);
+    };
+    const rd::shaders::NormalTable table(encode);
+
+    int worst = 0;
+    for (auto const& direction: directions)
+        worst = std::max(worst, channelError(table(direction), encode(direction)));
+    CHECK(worst <= 4);
+    CHECK(channelError(table(3.0f*directions[0]), table(directions[0])) == 0);
+
+    // Ambient light
+    const rd::Color sky(200, 220, 255, 255), ground(40, 30, 20, 255);
+    const glm::vec3 up(0.0f, 1.0f, 0.0f), side(1.0f, 0.0f, 0.0f);
+
+    const rd::shaders::SphericalHarmonics uniform = rd::shaders::SphericalHarmonics::constant(sky);
+    for (auto const& direction: { up, side, -up })
+        CHECK(glm::length(uniform.irradiance(direction) - glm::vec3(sky)) < 1.0f);
+
+    const rd::shaders::SphericalHarmonics hemisphere = rd::shaders::SphericalHarmonics::hemisphere(sky, ground, up);
+    const glm::vec3 average = 0.5f*(glm::vec3(sky) + glm::vec3(ground));
+    CHECK(glm::length(hemisphere.irradiance(side) - average) < 1.0f);
+    CHECK(glm::length(hemisphere.irradiance(up) - glm::vec3(sky)) < glm::length(hemisphere.irradiance(up) - average));
+    CHECK(glm::length(hemisphere.irradiance(-up) - glm::vec3(ground)) < glm::length(hemisphere.irradiance(-up) - average));
+
+    // A white surface lit by one light along -z, with no ambient light
+    const rd::Color white(255, 255, 255, 255), light(200, 100, 50, 255);
+    const rd::Shader lit = rd::shaders::lighting(white, { { glm::vec3(0.0f, 0.0f, -1.0f), light } },
+                                                 rd::shaders::SphericalHarmonics::constant(rd::Color(0, 0, 0, 255)));
+
+    const glm::vec3 origin(0.0f);
+    CHECK(channelError(lit(origin, origin, glm::vec3(0.0f, 0.0f, 1.0f)), light) <= 1);
+    CHECK(channelError(lit(origin, origin, glm::vec3(0.0f, 0.0f, -1.0f)), rd::Color(0, 0, 0, 255)) == 0);
+    CHECK(channelError(lit(origin, origin, glm::vec3(std::sqrt(0.75f), 0.0f, 0.5f)), rd::Color(100, 50, 25, 255)) <= 2);
+
+    // Matcap textures are looked up by view-space normal, left to right
+    const size_t size = 64;
+    std::vector<rd::Color> texels(size*size);
+    for (size_t y = 0; y < size; ++y)
+        for (size_t x = 0; x < size; ++x)
+            texels[y*size + x] = (x < size/2) ? rd::Color(255, 0, 0, 255) : rd::Color(0, 0, 255, 255);
+
+    const rd::Image<rd::Color> texture(texels.data(), size, size);
+    const rd::Shader matcap = rd::shaders::matcap(texture, glm::mat4(1.0f));
+    CHECK(matcap(origin, origin, glm::normalize(glm::vec3(-1.0f, 0.2f, 1.0f))) == rd::Color(255, 0, 0, 255));
+    CHECK(matcap(origin, origin, glm::normalize(glm::vec3(1.0f, -0.2f, 1.0f))) == rd::Color(0, 0, 255, 255));
+
+    // Rotating the view turns the right side of the model to the left
+    const rd::Shader turned = rd::shaders::matcap(texture, glm::rotate(glm::mat4(1.0f), glm::pi<float>(), up));
+    CHECK(turned(origin, origin, glm::normalize(glm::vec3(1.0f, 0.2f, -1.0f))) == rd::Color(255, 0, 0, 255));
+
+    return test::result();
+}
@@ -0,0 +1,84 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+// Depth-only renders match the depth of color renders; shadow maps tell
+// lit points from occluded ones
+int main() {
+    const rd::Model model = test::torus();
+    const rd::IndexedMesh mesh(model);
+    const size_t width = 160, height = 120;
+
+    test::Frame expected(width, height), frame(width, height);
+    const glm::vec3 directions[] = { glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 2.0f, 0.5f) };
+    for (auto const& direction: directions) {
+        const glm::mat4 mvp = test::view(model.boundingBox(), direction, width, height);
+
+        expected.clear();
+        const size_t rendered = rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+
+        frame.clear();
+        CHECK(rd::render(frame.depth, model, mvp) == rendered);
+        CHECK(frame.depths == expected.depths);
+
+        frame.clear();
+        CHECK(rd::render(frame.depth, mesh, mvp) == rendered);
+        CHECK(frame.depths == expected.depths);
+    }
+
+    // A slab floating over a floor, lit from straight above
+    rd::Model scene = test::box(rd::AABB{ glm::vec3(-4.0f, -1.0f, -4.0f), glm::vec3(4.0f, 0.0f, 4.0f) });
+    const rd::Model slab = test::box(rd::AABB{ glm::vec3(-1.0f, 1.0f, -1.0f), glm::vec3(1.0f, 1.2f, 1.0f) });
+    scene.insert(scene.end(), slab.begin(), slab.end());
+    scene.updateBoundingBox();
+
+    const glm::vec3 down(0.0f, -1.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+    rd::ShadowMap map(rd::ShadowMap::directional(down, scene.boundingBox()), 256, 256);
+    CHECK(map.render(scene) > 0);
+
+    CHECK(map.visibility(glm::vec3(0.0f, 0.0f, 0.0f), up) == 0.0f);
+    CHECK(map.visibility(glm::vec3(3.0f, 0.0f, 3.0f), up) == 1.0f);
+    CHECK(map.visibility(glm::vec3(0.0f, 1.2f, 0.0f), up) == 1.0f);
+    CHECK(map.visibility(glm::vec3(50.0f, 0.0f, 0.0f), up) == 1.0f);
+
+    // On the edge of the shadow, filtering gives partial light
+    const float edge = map.visibility(glm::vec3(1.0f, 0.0f, 0.0f), up, 2);
+    CHECK(edge > 0.0f && edge < 1.0f);
+
+    const rd::Color ambient(20, 20, 20, 255), diffuse(200, 200, 200, 255);
+    const rd::Shader shader = rd::shaders::shadowedDirectional(map, down, ambient, diffuse);
+    const glm::vec3 frag(0.0f);
+    CHECK(shader(frag, glm::vec3(0.0f, 0.0f, 0.0f), up) == ambient);
+    CHECK(shader(frag, glm::vec3(3.0f, 0.0f, 3.0f), up) == rd::Color(220, 220, 220, 255));
+
+    // Cleared maps cast no shadows
+    map.clear();
+    CHECK(map.visibility(glm::vec3(0.0f, 0.0f, 0.0f), up) == 1.0f);
+
+    return test::result();
+}
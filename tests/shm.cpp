@@ -0,0 +1,110 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+#include "shm.hpp"
+
+#include <sys/wait.h>
+
+namespace rd = rendirt;
+
+namespace {
+    bool exists(std::string const& name) {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        ::close(fd);
+        return true;
+    }
+
+    // Runs body in a child process that exits without running destructors,
+    // as if it crashed. Handles must be leaked to stay held
+    template<typename Body>
+    void crash(Body const& body) {
+        pid_t child = ::fork();
+        if (child == 0) {
+            body();
+            ::_exit(0);
+        }
+        ::waitpid(child, nullptr, 0);
+    }
+} /* namespace */
+
+// Publishing, reference counting across handles and processes, and
+// recovery of segments whose holders died
+int main() {
+    const rd::Model model = test::torus();
+    const std::string name = "/rendirt-test-" + std::to_string(::getpid());
+    ::shm_unlink(name.c_str());
+
+    {
+        shm::SharedModel published = shm::SharedModel::publish(name, model);
+        CHECK(published);
+        CHECK(!shm::SharedModel::publish(name, model));
+
+        shm::SharedModel opened = shm::SharedModel::open(name);
+        CHECK(opened);
+        CHECK(opened.size() == model.size());
+        CHECK(opened.data()[7].vertex[2] == model[7].vertex[2]);
+        CHECK(opened.boundingBox().to == model.boundingBox().to);
+
+        // The segment lives until the last handle goes
+        published.release();
+        CHECK(exists(name));
+        opened.release();
+        CHECK(!exists(name));
+        CHECK(!shm::SharedModel::open(name));
+    }
+
+    // Slots of crashed holders are recycled: the last live holder unlinks
+    crash([&] {
+        new shm::SharedModel(shm::SharedModel::publish(name, model));
+        new shm::SharedModel(shm::SharedModel::open(name));
+    });
+    CHECK(exists(name));
+    {
+        shm::SharedModel opened = shm::SharedModel::open(name);
+        CHECK(opened);
+        CHECK(opened.size() == model.size());
+    }
+    CHECK(!exists(name));
+
+    // Segments with no live holder are reclaimed; held ones are not
+    crash([&] {
+        new shm::SharedModel(shm::SharedModel::publish(name, model));
+    });
+    CHECK(shm::SharedModel::reclaim(name));
+    CHECK(!exists(name));
+
+    {
+        shm::SharedModel published = shm::SharedModel::openOrPublish(name, model);
+        CHECK(published);
+        CHECK(!shm::SharedModel::reclaim(name));
+        CHECK(exists(name));
+    }
+    CHECK(!exists(name));
+
+    return test::result();
+}
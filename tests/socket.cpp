@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+#include "common.hpp"
+#include "socket.hpp"
+
+#include <sys/socket.h>
+
+#include <thread>
+
+namespace rd = rendirt;
+
+// Request framing used by rendirtd: lines, inline payloads that can be
+// parsed in place or skipped, and the output formats it accepts
+int main() {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    const std::string model = test::binarySTL(test::torus());
+
+    // Sixth field of a RENDER request
+    auto format = [](std::string const& request) {
+        std::istringstream fields(request);
+        std::string field;
+        for (int i = 0; i < 6; ++i)
+            fields >> field;
+        return field;
+    };
+
+    // Larger than a socket buffer: the writer runs concurrently
+    std::thread writer([&] {
+        sock::writeAll(fds[1], "RENDER - 64x64 diffuse iso png " + std::to_string(model.size()) + "\n");
+        sock::writeAll(fds[1], model);
+        sock::writeAll(fds[1], "RENDER - 64x64 diffuse iso tiff " + std::to_string(model.size()) + "\n");
+        sock::writeAll(fds[1], model);
+        sock::writeAll(fds[1], "STATS\n");
+        ::close(fds[1]);
+    });
+
+    sock::Reader reader(fds[0]);
+    std::string line;
+
+    // An unknown format is rejected, and its payload skipped
+    CHECK(reader.readLine(line));
+    CHECK(!tool::isImageFormat(format(line)));
+    CHECK(reader.skip(model.size()));
+
+    // The stream is still in sync: the next payload parses in place
+    CHECK(reader.readLine(line));
+    CHECK(tool::isImageFormat(format(line)));
+
+    std::string data(model.size(), '\0');
+    CHECK(reader.readExact(&data[0], data.size()));
+
+    tool::MemoryBuffer buffer(data.data(), data.size());
+    std::istream stream(&buffer);
+    rd::Model parsed;
+    CHECK(parsed.loadSTL(stream) == rd::Model::Ok);
+    CHECK(parsed.size() == test::torus().size());
+
+    CHECK(reader.readLine(line));
+    CHECK(line == "STATS");
+
+    // End of stream
+    CHECK(!reader.readLine(line));
+    CHECK(!reader.skip(1));
+
+    writer.join();
+    ::close(fds[0]);
+
+    CHECK(tool::isImageFormat("tiff") && tool::isImageFormat("bmp") && tool::isImageFormat("rgba"));
+    CHECK(!tool::isImageFormat("png") && !tool::isImageFormat(""));
+
+    return test::result();
+}
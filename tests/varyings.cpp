@@ -0,0 +1,86 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rd = rendirt;
+
+// Varyings are interpolated with perspective correction over the pixels
+// that plain renders cover
+int main() {
+    const size_t width = 160, height = 120;
+
+    // A floor seen at a grazing angle, where affine interpolation is off
+    // by a wide margin
+    const rd::Model floor = test::box(rd::AABB{ glm::vec3(-4.0f, -1.0f, -8.0f), glm::vec3(4.0f, 0.0f, 8.0f) });
+    const rd::IndexedMesh mesh(floor);
+    const glm::mat4 mvp = rd::Projection(rd::Projection::Perspective, 1.0f, width, height, 0.5f, 30.0f)*
+                          rd::Camera(glm::vec3(0.0f, 1.0f, 9.0f), glm::vec3(0.0f, 0.0f, -8.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 inverse = glm::inverse(mvp);
+
+    test::Frame expected(width, height), frame(width, height);
+    const size_t rendered = rd::render(expected.color, expected.depth, mesh, mvp, rd::shaders::normal);
+    CHECK(rendered > 0);
+    CHECK(expected.covered() > width*height/4);
+
+    // Constant values come through unchanged
+    const rd::Color red(255, 0, 0, 255);
+    const std::vector<glm::vec4> constant(mesh.vertices.size(), glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    CHECK(rd::render(frame.color, frame.depth, mesh, constant.data(), mvp, [](glm::vec3, glm::vec4 const& value) {
+        return rd::Color(glm::round(255.0f*glm::clamp(value, 0.0f, 1.0f)));
+    }) == rendered);
+    CHECK(frame.depths == expected.depths);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < frame.colors.size(); ++i)
+        mismatches += (frame.colors[i] != ((expected.depths[i] < 1.0f) ? red : expected.colors[i]));
+    CHECK(mismatches == 0);
+
+    // Interpolated positions match those found by unprojecting fragments
+    float error = 0.0f;
+    frame.clear();
+    rd::render(frame.color, frame.depth, mesh, mesh.vertices.data(), mvp, [&](glm::vec3 frag, glm::vec3 const& position) {
+        const glm::vec4 point = inverse*glm::vec4(frag, 1.0f);
+        error = std::max(error, glm::length(glm::vec3(point)/point.w - position));
+        return rd::Color(0, 0, 0, 255);
+    });
+    CHECK(error < 1e-3f);
+
+    // Packed normals are unpacked before interpolation
+    const glm::vec3 direction = glm::normalize(glm::vec3(0.3f, 0.9f, -0.2f));
+    const std::vector<rd::PackedNormal> normals(mesh.vertices.size(), rd::PackedNormal(direction));
+    error = 0.0f;
+    frame.clear();
+    rd::render(frame.color, frame.depth, mesh, normals.data(), mvp, [&](glm::vec3, glm::vec3 const& normal) {
+        error = std::max(error, glm::length(normal - direction));
+        return rd::Color(0, 0, 0, 255);
+    });
+    CHECK(error < 1e-3f);
+
+    return test::result();
+}
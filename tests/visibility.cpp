@@ -0,0 +1,84 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "check.hpp"
+
+namespace rd = rendirt;
+
+// Faces enclosed by other parts are removed without changing renders
+int main() {
+    const rd::Model shell = test::box(rd::AABB{ glm::vec3(-2.0f), glm::vec3(2.0f) });
+    const rd::Model inside = test::torus(24, 12);
+    const rd::Model outside = test::torus(24, 12, 1.0f, 0.4f);
+
+    rd::Model model = shell;
+    model.insert(model.end(), inside.begin(), inside.end());
+    for (auto face: outside) {
+        for (auto& vertex: face.vertex)
+            vertex.x += 4.0f;
+        model.push_back(face);
+    }
+    model.updateBoundingBox();
+
+    const std::vector<bool> visible = rd::findVisibleFaces(model, model.boundingBox());
+    CHECK(visible.size() == model.size());
+
+    size_t shellVisible = 0, insideVisible = 0, outsideVisible = 0;
+    for (size_t i = 0; i < model.size(); ++i) {
+        if (i < shell.size())
+            shellVisible += visible[i];
+        else if (i < shell.size() + inside.size())
+            insideVisible += visible[i];
+        else
+            outsideVisible += visible[i];
+    }
+
+    CHECK(shellVisible == shell.size());
+    CHECK(insideVisible == 0);
+    CHECK(outsideVisible > outside.size()*9/10);
+
+    const rd::Model pruned = rd::removeHiddenFaces(model);
+    CHECK(pruned.size() == shellVisible + outsideVisible);
+    CHECK(pruned.boundingBox().from == model.boundingBox().from);
+    CHECK(pruned.boundingBox().to == model.boundingBox().to);
+
+    const size_t width = 160, height = 120;
+    const glm::vec3 directions[] = {
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f),
+        glm::vec3(-0.5f, 2.0f, 0.3f), glm::vec3(0.7f, -0.4f, -1.0f)
+    };
+
+    test::Frame expected(width, height), frame(width, height);
+    for (auto const& direction: directions) {
+        const glm::mat4 mvp = test::view(model.boundingBox(), direction, width, height);
+        expected.clear();
+        frame.clear();
+        rd::render(expected.color, expected.depth, model, mvp, rd::shaders::normal);
+        rd::render(frame.color, frame.depth, pruned, mvp, rd::shaders::normal);
+        CHECK(test::differences(frame, expected) == 0);
+    }
+
+    return test::result();
+}
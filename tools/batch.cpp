@@ -0,0 +1,405 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "rendirt.hpp"
+#include "cache.hpp"
+#include "common.hpp"
+#include "mapped.hpp"
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rd = rendirt;
+
+namespace {
+    using clock = std::chrono::steady_clock;
+    using frac_ms = std::chrono::duration<float, std::milli>;
+
+    float elapsed(clock::time_point since, clock::time_point until = clock::now()) {
+        return std::chrono::duration_cast<frac_ms>(until - since).count();
+    }
+
+    // Bounded job queue: the reader blocks when workers fall behind,
+    // so arbitrarily long manifests are processed in constant memory
+    class JobQueue {
+    public:
+        explicit JobQueue(size_t capacity) : capacity_(capacity) {}
+
+        void push(tool::Job job) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notFull_.wait(lock, [this] { return jobs_.size() < capacity_; });
+            jobs_.push_back(std::move(job));
+            notEmpty_.notify_one();
+        }
+
+        // Returns false when the queue is closed and drained
+        bool pop(tool::Job& job) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notEmpty_.wait(lock, [this] { return closed_ || !jobs_.empty(); });
+            if (jobs_.empty())
+                return false;
+
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            notFull_.notify_one();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            notEmpty_.notify_all();
+        }
+
+    private:
+        size_t capacity_;
+        bool closed_ = false;
+        std::deque<tool::Job> jobs_;
+        std::mutex mutex_;
+        std::condition_variable notEmpty_, notFull_;
+    };
+
+    // Per-thread state. Model storage, file data and render targets are
+    // reused across jobs to avoid reallocating on every file.
+    struct Worker {
+        rd::Model model;
+        tool::Target target;
+        std::string data, image;
+    };
+
+    struct Report {
+        std::mutex mutex;
+        size_t done = 0;
+        size_t failed = 0;
+    };
+
+    void fail(Report& report, tool::Job const& job, std::string const& message) {
+        std::lock_guard<std::mutex> lock(report.mutex);
+        ++report.done;
+        ++report.failed;
+        std::cerr << job.input << ": " << message << std::endl;
+        std::cout << job.output << "\tfailed" << std::endl;
+    }
+
+    bool writeFile(std::string const& path, std::string const& data) {
+        std::ofstream output(path, std::ofstream::binary);
+        return output.write(data.data(), data.size()) && (output.close(), output);
+    }
+
+    // Renders a mapped binary STL file out of core, in bounded memory
+    void processMapped(Worker& worker, tool::Job const& job, mapped::MappedSTL const& stl,
+                       clock::time_point start, Report& report)
+    {
+        rd::AABB bbox = mapped::boundingBox(stl);
+
+        rd::Shader shader;
+        if (!tool::makeShader(job.shader, bbox, shader)) {
+            fail(report, job, "unknown shader '" + job.shader + "'");
+            return;
+        }
+
+        glm::mat4 modelViewProj;
+        if (!tool::makeCamera(job.camera, bbox, job.width, job.height, modelViewProj)) {
+            fail(report, job, "unknown camera preset '" + job.camera + "'");
+            return;
+        }
+
+        auto loaded = clock::now();
+
+        worker.target.reset(job.width, job.height);
+        size_t count = mapped::render(worker.target.color, worker.target.depth,
+                                      stl, modelViewProj, shader);
+
+        auto rendered = clock::now();
+
+        if (!tool::encodeImage("tiff", worker.target.color, worker.image)) {
+            fail(report, job, "image encoding failed");
+            return;
+        }
+
+        if (!writeFile(job.output, worker.image)) {
+            fail(report, job, job.output + ": write failed: " + std::strerror(errno));
+            return;
+        }
+
+        auto written = clock::now();
+
+        std::lock_guard<std::mutex> lock(report.mutex);
+        ++report.done;
+        std::cout << job.output << "\tok"
+                  << "\tbounds=" << elapsed(start, loaded) << "ms"
+                  << "\trender=" << elapsed(loaded, rendered) << "ms"
+                  << "\twrite=" << elapsed(rendered, written) << "ms"
+                  << "\tfaces=" << stl.size()
+                  << "\trasterized=" << count
+                  << "\tstreamed"
+                  << std::endl;
+    }
+
+    void process(Worker& worker, tool::Job const& job, cache::Store* store,
+                 size_t streamThreshold, Report& report)
+    {
+        auto start = clock::now();
+
+        struct stat st;
+        if (streamThreshold && ::stat(job.input.c_str(), &st) == 0 && size_t(st.st_size) > streamThreshold) {
+            mapped::MappedSTL stl;
+            if (stl.open(job.input)) {
+                processMapped(worker, job, stl, start, report);
+                return;
+            }
+
+            // Text STL files and binary files with trailing data are not
+            // mapped: they are loaded in memory below
+            if (errno != EINVAL) {
+                fail(report, job, std::string("cannot map binary STL: ") + std::strerror(errno));
+                return;
+            }
+        }
+
+        std::ifstream file(job.input, std::ifstream::binary);
+        if (!file) {
+            fail(report, job, std::string("cannot open file for reading: ") + std::strerror(errno));
+            return;
+        }
+
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        if (!file || size < 0) {
+            fail(report, job, "cannot determine file size");
+            return;
+        }
+
+        worker.data.resize(size_t(size));
+        file.seekg(0, std::ios::beg);
+        if (!file.read(&worker.data[0], worker.data.size())) {
+            fail(report, job, std::string("read failed: ") + std::strerror(errno));
+            return;
+        }
+        file.close();
+
+        // Look up the rendered image by model content and render parameters
+        cache::Hash key = {};
+        if (store) {
+            key = cache::key(cache::hash(worker.data),
+                             std::to_string(job.width) + "x" + std::to_string(job.height) + " " +
+                             job.shader + " " + job.camera + " tiff");
+
+            if (store->find(key, worker.image)) {
+                if (!writeFile(job.output, worker.image)) {
+                    fail(report, job, job.output + ": write failed: " + std::strerror(errno));
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(report.mutex);
+                ++report.done;
+                std::cout << job.output << "\tcached"
+                          << "\ttotal=" << elapsed(start) << "ms"
+                          << std::endl;
+                return;
+            }
+        }
+
+        tool::MemoryBuffer buffer(worker.data.data(), worker.data.size());
+        std::istream stream(&buffer);
+        rd::Model::Error err = worker.model.loadSTL(stream);
+
+        if (err != rd::Model::Ok) {
+            fail(report, job, std::string("model load failed: ") + rd::Model::errorString(err));
+            return;
+        }
+
+        rd::Shader shader;
+        if (!tool::makeShader(job.shader, worker.model.boundingBox(), shader)) {
+            fail(report, job, "unknown shader '" + job.shader + "'");
+            return;
+        }
+
+        glm::mat4 modelViewProj;
+        if (!tool::makeCamera(job.camera, worker.model.boundingBox(), job.width, job.height, modelViewProj)) {
+            fail(report, job, "unknown camera preset '" + job.camera + "'");
+            return;
+        }
+
+        auto loaded = clock::now();
+
+        worker.target.reset(job.width, job.height);
+        size_t count = rd::render(worker.target.color, worker.target.depth,
+                                  worker.model, modelViewProj, shader);
+
+        auto rendered = clock::now();
+
+        if (!tool::encodeImage("tiff", worker.target.color, worker.image)) {
+            fail(report, job, "image encoding failed");
+            return;
+        }
+
+        if (!writeFile(job.output, worker.image)) {
+            fail(report, job, job.output + ": write failed: " + std::strerror(errno));
+            return;
+        }
+
+        if (store)
+            store->store(key, worker.image);
+
+        auto written = clock::now();
+
+        std::lock_guard<std::mutex> lock(report.mutex);
+        ++report.done;
+        std::cout << job.output << "\tok"
+                  << "\tload=" << elapsed(start, loaded) << "ms"
+                  << "\trender=" << elapsed(loaded, rendered) << "ms"
+                  << "\twrite=" << elapsed(rendered, written) << "ms"
+                  << "\tfaces=" << worker.model.size()
+                  << "\trasterized=" << count
+                  << std::endl;
+    }
+
+    void usage(char const* name) {
+        std::cerr << "Usage: " << name << " [-j THREADS] [-C CACHE_DIR [-M CACHE_MB]] [-O STREAM_MB] [MANIFEST]\n"
+                  << "Renders every job listed in MANIFEST (or read from stdin when\n"
+                  << "MANIFEST is omitted or '-'). One job per line:\n"
+                  << "  input.stl output.tiff [WIDTHxHEIGHT] [SHADER] [CAMERA]\n"
+                  << "SHADER: depth, position, normal, diffuse (default), studio\n"
+                  << "CAMERA: iso (default), front, back, left, right, top, bottom,\n"
+                  << "        optionally suffixed with -ortho\n"
+                  << "With -C, rendered images are looked up in and stored to an on-disk\n"
+                  << "cache keyed by model content and job parameters, limited to\n"
+                  << "CACHE_MB megabytes (default 1024).\n"
+                  << "With -O, binary STL inputs larger than STREAM_MB megabytes are\n"
+                  << "memory-mapped and rendered out of core in bounded memory (these\n"
+                  << "jobs bypass the cache).\n"
+                  << "Per-job timings are written to stdout, errors to stderr."
+                  << std::endl;
+    }
+} /* namespace */
+
+int main(int argc, char* argv[]) {
+    size_t threads = std::thread::hardware_concurrency();
+    char const* manifest = nullptr;
+    char const* cacheDir = nullptr;
+    size_t cacheSize = 1024;
+    size_t streamThreshold = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (std::strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            cacheSize = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-O") == 0 && i + 1 < argc) {
+            streamThreshold = std::strtoul(argv[++i], nullptr, 10)*1024*1024;
+        } else if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (!manifest && (argv[i][0] != '-' || argv[i][1] == '\0')) {
+            manifest = argv[i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (threads == 0)
+        threads = 1;
+
+    std::istream* source = &std::cin;
+    std::ifstream file;
+
+    if (manifest && std::strcmp(manifest, "-") != 0) {
+        source = &file;
+        file.open(manifest);
+        if (!file) {
+            std::cerr << manifest << ": cannot open file for reading: " << strerror(errno) << std::endl;
+            return -1;
+        }
+    }
+
+    std::unique_ptr<cache::Store> store;
+    if (cacheDir)
+        store.reset(new cache::Store(cacheDir, cacheSize*1024*1024));
+
+    auto start = clock::now();
+
+    JobQueue queue(4*threads);
+    Report report;
+    std::vector<std::thread> pool;
+
+    for (size_t i = 0; i < threads; ++i)
+        pool.emplace_back([&queue, &store, streamThreshold, &report] {
+            Worker worker;
+            tool::Job job;
+            while (queue.pop(job))
+                process(worker, job, store.get(), streamThreshold, report);
+        });
+
+    std::string line, error;
+    size_t lineNumber = 0, malformed = 0;
+
+    while (std::getline(*source, line)) {
+        ++lineNumber;
+
+        tool::Job job;
+        if (!tool::parseJob(line, job, error)) {
+            std::cerr << (manifest ? manifest : "stdin") << ":" << lineNumber << ": " << error << std::endl;
+            ++malformed;
+            continue;
+        }
+
+        if (!job.input.empty())
+            queue.push(std::move(job));
+    }
+
+    queue.close();
+    for (auto& thread: pool)
+        thread.join();
+
+    float total = elapsed(start);
+
+    std::cerr << "Jobs: " << report.done << " (" << report.failed << " failed, "
+              << malformed << " malformed)\n"
+              << "Threads: " << threads << '\n'
+              << "Total time: " << total << " ms";
+    if (report.done)
+        std::cerr << " (" << total/report.done << " ms/job)";
+    std::cerr << std::endl;
+
+    if (store)
+        std::cerr << "Cache: " << store->stats() << std::endl;
+
+    return (report.failed || malformed) ? 1 : 0;
+}
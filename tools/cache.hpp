@@ -0,0 +1,333 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Content-addressed on-disk cache of encoded images.
+namespace cache {
+    // 128-bit non-cryptographic hash.
+    // Input is consumed in 32-byte stripes by eight independent 32-bit lanes
+    // (xxHash32 rounds) in plain scalar code; independent lanes keep several
+    // multiplies in flight. Lanes are folded into two 64-bit words at the end.
+    struct Hash {
+        std::uint64_t lo, hi;
+
+        bool operator==(Hash const& other) const {
+            return lo == other.lo && hi == other.hi;
+        }
+
+        std::string hex() const {
+            static char const digits[] = "0123456789abcdef";
+            std::string str(32, '0');
+            for (int i = 0; i < 16; ++i) {
+                str[15 - i] = digits[(hi >> (4*i)) & 0xf];
+                str[31 - i] = digits[(lo >> (4*i)) & 0xf];
+            }
+            return str;
+        }
+    };
+
+    namespace detail {
+        constexpr std::uint32_t P1 = 2654435761u, P2 = 2246822519u;
+        constexpr std::uint64_t Q1 = 0xbf58476d1ce4e5b9ull, Q2 = 0x94d049bb133111ebull;
+
+        inline std::uint32_t rotl(std::uint32_t x, int r) {
+            return (x << r) | (x >> (32 - r));
+        }
+
+        inline std::uint64_t mix(std::uint64_t x) {
+            x = (x ^ (x >> 30))*Q1;
+            x = (x ^ (x >> 27))*Q2;
+            return x ^ (x >> 31);
+        }
+
+        inline void stripe(std::uint32_t (&acc)[8], unsigned char const* data) {
+            std::uint32_t words[8];
+            std::memcpy(words, data, sizeof(words));
+
+            for (int i = 0; i < 8; ++i)
+                acc[i] = rotl(acc[i] + words[i]*P2, 13)*P1;
+        }
+    } /* namespace detail */
+
+    inline Hash hash(void const* data, size_t size, std::uint64_t seed = 0) {
+        using namespace detail;
+
+        std::uint32_t acc[8];
+        for (int i = 0; i < 8; ++i)
+            acc[i] = std::uint32_t(seed) + std::uint32_t(seed >> 32) + P1*(i + 1);
+
+        unsigned char const* p = static_cast<unsigned char const*>(data);
+        unsigned char const* end = p + (size & ~size_t(31));
+
+        for (; p != end; p += 32)
+            stripe(acc, p);
+
+        // Zero-padded tail stripe; the length is folded in below
+        unsigned char tail[32] = {};
+        std::memcpy(tail, p, size & 31);
+        stripe(acc, tail);
+
+        std::uint64_t lo = mix(seed ^ size), hi = mix(~seed ^ (size*Q1));
+        for (int i = 0; i < 4; ++i) {
+            lo = mix(lo ^ ((std::uint64_t(acc[2*i]) << 32) | acc[2*i + 1]));
+            hi = mix(hi ^ ((std::uint64_t(acc[7 - 2*i]) << 32) | acc[6 - 2*i]));
+        }
+
+        return Hash{ lo, hi ^ lo };
+    }
+
+    inline Hash hash(std::string const& str, std::uint64_t seed = 0) {
+        return hash(str.data(), str.size(), seed);
+    }
+
+    // Combines the hash of model data with a description of render
+    // parameters (size, shader, camera, format...).
+    inline Hash key(Hash const& model, std::string const& params) {
+        return hash(params, model.lo ^ detail::mix(model.hi));
+    }
+
+    // Directory-backed store. Entries are files named after their key and
+    // fanned out into 256 subdirectories. Writes go to a temporary file that
+    // is renamed into place, so readers (including other processes) never
+    // observe partial entries. When the total size exceeds the limit, least
+    // recently used entries are evicted (hits refresh modification time).
+    class Store {
+    public:
+        struct Stats {
+            size_t hits, misses, stores, evictions, size;
+
+            double hitRate() const {
+                return (hits + misses) ? double(hits)/double(hits + misses) : 0.0;
+            }
+        };
+
+        explicit Store(std::string dir, size_t maxSize)
+            : dir_(std::move(dir)), maxSize_(maxSize)
+        {
+            if (!dir_.empty() && dir_.back() == '/')
+                dir_.pop_back();
+
+            ::mkdir(dir_.c_str(), 0777);
+            size_ = scan(nullptr);
+        }
+
+        // Returns true and fills data when the entry exists
+        bool find(Hash const& key, std::string& data) {
+            std::string path = pathOf(key);
+
+            // Anything but a regular file is a miss: seeking to the end of
+            // a directory, for one, yields no usable size
+            struct stat st;
+            std::ifstream file;
+            if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                file.open(path, std::ifstream::binary);
+
+            if (!file.is_open()) {
+                ++misses_;
+                return false;
+            }
+
+            // tellg() returns -1 if the size cannot be determined
+            file.seekg(0, std::ios::end);
+            const std::streamoff size = file.tellg();
+            if (size < 0) {
+                ++misses_;
+                return false;
+            }
+
+            data.resize(size_t(size));
+            file.seekg(0, std::ios::beg);
+            if (!file.read(&data[0], data.size())) {
+                ++misses_;
+                return false;
+            }
+
+            ::utimes(path.c_str(), nullptr);
+            ++hits_;
+            return true;
+        }
+
+        bool store(Hash const& key, std::string const& data) {
+            std::string path = pathOf(key);
+            std::string subdir = path.substr(0, path.rfind('/'));
+            ::mkdir(subdir.c_str(), 0777);
+
+            std::string tmp = subdir + "/.tmp." + std::to_string(::getpid()) + "." +
+                              std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." +
+                              std::to_string(counter_++);
+
+            {
+                std::ofstream file(tmp, std::ofstream::binary);
+                if (!file.write(data.data(), data.size()) || !(file.close(), file)) {
+                    std::remove(tmp.c_str());
+                    return false;
+                }
+            }
+
+            // An entry being replaced no longer counts toward the total
+            struct stat st;
+            size_t replaced = (::stat(path.c_str(), &st) == 0) ? size_t(st.st_size) : 0;
+
+            if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+                std::remove(tmp.c_str());
+                return false;
+            }
+
+            ++stores_;
+            size_ -= std::min<size_t>(replaced, size_);
+            if ((size_ += data.size()) > maxSize_)
+                evict();
+
+            return true;
+        }
+
+        Stats stats() const {
+            return Stats{ hits_, misses_, stores_, evictions_, size_ };
+        }
+
+    private:
+        struct Entry {
+            std::string path;
+            timespec mtime;
+            size_t size;
+        };
+
+        // Temporary files older than this (in seconds) were left by writers
+        // that crashed before renaming them into place
+        static constexpr time_t StaleTempAge = 3600;
+
+        std::string pathOf(Hash const& key) const {
+            std::string hex = key.hex();
+            return dir_ + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+        }
+
+        // Returns total size of entries; lists them when entries is not null.
+        // Stale temporary files are removed along the way.
+        size_t scan(std::vector<Entry>* entries) const {
+            size_t total = 0;
+            const time_t now = ::time(nullptr);
+
+            DIR* top = ::opendir(dir_.c_str());
+            if (!top)
+                return 0;
+
+            while (dirent* sub = ::readdir(top)) {
+                if (sub->d_name[0] == '.')
+                    continue;
+
+                std::string subdir = dir_ + "/" + sub->d_name;
+                DIR* d = ::opendir(subdir.c_str());
+                if (!d)
+                    continue;
+
+                while (dirent* ent = ::readdir(d)) {
+                    bool temporary = std::strncmp(ent->d_name, ".tmp.", 5) == 0;
+                    if (ent->d_name[0] == '.' && !temporary)
+                        continue;
+
+                    std::string path = subdir + "/" + ent->d_name;
+                    struct stat st;
+                    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+                        continue;
+
+                    if (temporary) {
+                        if (now - st.st_mtime > StaleTempAge)
+                            std::remove(path.c_str());
+                        continue;
+                    }
+
+                    total += st.st_size;
+                    if (entries)
+                        entries->push_back(Entry{ path, st.st_mtim, size_t(st.st_size) });
+                }
+
+                ::closedir(d);
+            }
+
+            ::closedir(top);
+            return total;
+        }
+
+        // Removes oldest entries until the store is below 90% of its limit.
+        // Rescans the directory, since other processes may share the store.
+        void evict() {
+            std::lock_guard<std::mutex> lock(evictMutex_);
+
+            std::vector<Entry> entries;
+            size_t total = scan(&entries);
+
+            std::sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b) {
+                return a.mtime.tv_sec < b.mtime.tv_sec ||
+                       (a.mtime.tv_sec == b.mtime.tv_sec && a.mtime.tv_nsec < b.mtime.tv_nsec);
+            });
+
+            size_t target = maxSize_ - maxSize_/10;
+            for (auto const& entry: entries) {
+                if (total <= target)
+                    break;
+
+                if (std::remove(entry.path.c_str()) == 0) {
+                    total -= entry.size;
+                    ++evictions_;
+                }
+            }
+
+            size_ = total;
+        }
+
+        std::string dir_;
+        size_t maxSize_;
+        std::atomic<size_t> size_{0};
+        std::atomic<size_t> hits_{0}, misses_{0}, stores_{0}, evictions_{0};
+        std::atomic<size_t> counter_{0};
+        std::mutex evictMutex_;
+    };
+
+    inline std::ostream& operator<<(std::ostream& stream, Store::Stats const& stats) {
+        return stream << stats.hits << " hits, " << stats.misses << " misses ("
+                      << 100.0*stats.hitRate() << "% hit rate), "
+                      << stats.stores << " stores, " << stats.evictions << " evictions, "
+                      << double(stats.size)/(1024.0*1024.0) << " MB";
+    }
+} /* namespace cache */
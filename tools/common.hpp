@@ -0,0 +1,265 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "rendirt.hpp"
+#include "bitmap.hpp"
+#include "tiff.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cstdlib>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Helpers shared by command line tools: job description parsing,
+// shader and camera presets, reusable render targets and image output.
+namespace tool {
+    namespace rd = rendirt;
+
+    // A single render job. Textual form (whitespace separated):
+    //   input output [WIDTHxHEIGHT] [shader] [camera]
+    struct Job {
+        std::string input;
+        std::string output;
+        size_t width = 800;
+        size_t height = 600;
+        std::string shader = "diffuse";
+        std::string camera = "iso";
+    };
+
+    inline bool parseSize(std::string const& str, size_t& width, size_t& height) {
+        char* end = nullptr;
+        unsigned long w = std::strtoul(str.c_str(), &end, 10);
+        if (end == str.c_str() || (*end != 'x' && *end != 'X'))
+            return false;
+
+        char const* hstr = end + 1;
+        unsigned long h = std::strtoul(hstr, &end, 10);
+        if (end == hstr || *end != '\0' || w == 0 || h == 0 || w > 16384 || h > 16384)
+            return false;
+
+        width = w;
+        height = h;
+        return true;
+    }
+
+    // Returns false and sets error on malformed lines. Blank lines and
+    // comments (starting with '#') yield true with an empty job.input.
+    inline bool parseJob(std::string const& line, Job& job, std::string& error) {
+        std::istringstream stream(line);
+        std::string size;
+
+        job = Job();
+
+        if (!(stream >> job.input) || job.input[0] == '#') {
+            job.input.clear();
+            return true;
+        }
+
+        if (!(stream >> job.output)) {
+            error = "missing output path";
+            return false;
+        }
+
+        if (stream >> size && !parseSize(size, job.width, job.height)) {
+            error = "invalid size '" + size + "'";
+            return false;
+        }
+
+        stream >> job.shader >> job.camera;
+
+        std::string extra;
+        if (stream >> extra) {
+            error = "unexpected token '" + extra + "'";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Known shaders: depth, position, normal, diffuse, studio.
+    // studio lighting is baked once into a table shared by all jobs
+    inline bool makeShader(std::string const& name, rd::AABB const& bbox, rd::Shader& shader) {
+        if (name == "depth")
+            shader = rd::shaders::depth;
+        else if (name == "position")
+            shader = rd::shaders::position(bbox);
+        else if (name == "normal")
+            shader = rd::shaders::normal;
+        else if (name == "diffuse")
+            shader = rd::shaders::diffuseDirectional(
+                glm::vec3(0.0f, -1.0f, -1.0f), rd::Color(40, 40, 40, 255), rd::Color(200, 200, 200, 255));
+        else if (name == "studio") {
+            static const rd::Shader studio = rd::shaders::lighting(rd::Color(220, 220, 220, 255), {
+                    { glm::vec3(-1.0f, -1.0f, -1.0f), rd::Color(150, 140, 130, 255) },
+                    { glm::vec3(1.0f, -0.3f, 0.5f), rd::Color(60, 70, 90, 255) }
+                }, rd::shaders::SphericalHarmonics::hemisphere(rd::Color(70, 75, 85, 255), rd::Color(30, 25, 20, 255)));
+            shader = studio;
+        } else
+            return false;
+
+        return true;
+    }
+
+    // Camera presets name a viewing direction, optionally followed by
+    // '-ortho' to select orthographic projection (default is perspective):
+    // iso, front, back, left, right, top, bottom.
+    // The camera looks into the center of the bounding box from a distance
+    // equal to the length of its diagonal.
+    inline bool makeCamera(std::string const& name, rd::AABB const& bbox,
+                           size_t width, size_t height, glm::mat4& modelViewProj)
+    {
+        static const std::string orthoSuffix = "-ortho";
+
+        std::string preset = name;
+        bool ortho = false;
+
+        if (preset.size() > orthoSuffix.size() &&
+            preset.compare(preset.size() - orthoSuffix.size(), orthoSuffix.size(), orthoSuffix) == 0)
+        {
+            ortho = true;
+            preset.resize(preset.size() - orthoSuffix.size());
+        }
+
+        glm::vec3 dir, up(0.0f, 1.0f, 0.0f);
+
+        if (preset == "iso")
+            dir = glm::vec3(1.0f, 1.0f, 1.0f);
+        else if (preset == "front")
+            dir = glm::vec3(0.0f, 0.0f, 1.0f);
+        else if (preset == "back")
+            dir = glm::vec3(0.0f, 0.0f, -1.0f);
+        else if (preset == "left")
+            dir = glm::vec3(-1.0f, 0.0f, 0.0f);
+        else if (preset == "right")
+            dir = glm::vec3(1.0f, 0.0f, 0.0f);
+        else if (preset == "top")
+            dir = glm::vec3(0.0f, 1.0f, 0.0f), up = glm::vec3(0.0f, 0.0f, -1.0f);
+        else if (preset == "bottom")
+            dir = glm::vec3(0.0f, -1.0f, 0.0f), up = glm::vec3(0.0f, 0.0f, 1.0f);
+        else
+            return false;
+
+        float aspect = float(width) / float(height);
+        glm::vec3 center = (bbox.from + bbox.to) / 2.0f;
+        glm::vec3 diagonal = glm::abs(bbox.to - bbox.from);
+        float maxDim = glm::max(diagonal.x, glm::max(diagonal.y, diagonal.z));
+        float distance = glm::max(glm::length(diagonal), std::numeric_limits<float>::min());
+
+        rd::Camera view(center + distance*glm::normalize(dir), center, up);
+
+        if (ortho)
+            modelViewProj = rd::Projection(
+                rd::Projection::Orthographic,
+                -maxDim*aspect, maxDim*aspect,
+                -maxDim, maxDim,
+                0.0f, 2.0f*distance) * view;
+        else
+            modelViewProj = rd::Projection(
+                rd::Projection::Perspective,
+                60.0f/180.0f*glm::pi<float>(), float(width), float(height),
+                0.01f*distance, 2.0f*distance) * view;
+
+        return true;
+    }
+
+    // Read-only stream buffer over memory, for parsing data without copying
+    struct MemoryBuffer : std::streambuf {
+        MemoryBuffer(char const* data, size_t size) {
+            char* p = const_cast<char*>(data);
+            setg(p, p, p + size);
+        }
+    };
+
+    // Color and depth buffers that grow on demand and are reused across jobs
+    struct Target {
+        std::vector<rd::Color> colorBuffer;
+        std::vector<float> depthBuffer;
+
+        void reset(size_t width, size_t height, rd::Color background = rd::Color(0, 0, 0, 255)) {
+            if (colorBuffer.size() < width*height) {
+                colorBuffer.resize(width*height);
+                depthBuffer.resize(width*height);
+            }
+
+            color = rd::Image<rd::Color>(colorBuffer.data(), width, height);
+            depth = rd::Image<float>(depthBuffer.data(), width, height);
+
+            color.clear(background);
+            depth.clear(1.0f); // Depth buffer must be cleared to 1.0f
+        }
+
+        rd::Image<rd::Color> color = rd::Image<rd::Color>(nullptr, 0, 0);
+        rd::Image<float> depth = rd::Image<float>(nullptr, 0, 0);
+    };
+
+    // Converts image to premultiplied alpha in place
+    inline void premultiply(rd::Image<rd::Color> const& img) {
+        using RGB48 = glm::vec<3, std::uint16_t>;
+
+        for (size_t i = 0, end = img.height*img.stride; i < end; i += img.stride - img.width)
+            for (size_t rend = i + img.width; i < rend; ++i)
+                img.buffer[i] = rd::Color(RGB48(img.buffer[i]) * std::uint16_t(img.buffer[i].a) / std::uint16_t(255), img.buffer[i].a);
+    }
+
+    // Premultiplies and encodes image as TIFF. The image is modified.
+    inline bool writeImage(std::ostream& stream, rd::Image<rd::Color> const& img) {
+        premultiply(img);
+        return bool(tiff::writeTIFF(stream, img));
+    }
+
+    // Returns true if format is one of those accepted by encodeImage()
+    inline bool isImageFormat(std::string const& format) {
+        return format == "tiff" || format == "bmp" || format == "rgba";
+    }
+
+    // Encodes image in the given format (tiff, bmp or rgba) into a string.
+    // The image may be modified. Returns false for unknown formats or when
+    // encoding fails.
+    inline bool encodeImage(std::string const& format, rd::Image<rd::Color> const& img, std::string& data) {
+        std::ostringstream stream;
+
+        if (format == "tiff") {
+            if (!writeImage(stream, img))
+                return false;
+        } else if (format == "bmp") {
+            if (!bmp::writeBitmap(stream, img))
+                return false;
+        } else if (format == "rgba") {
+            for (size_t line = 0, end = img.height*img.stride; line < end; line += img.stride)
+                stream.write(reinterpret_cast<char const*>(img.buffer + line), img.width*sizeof(rd::Color));
+        } else {
+            return false;
+        }
+
+        data = stream.str();
+        return true;
+    }
+} /* namespace tool */
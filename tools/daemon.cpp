@@ -0,0 +1,522 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "rendirt.hpp"
+#include "cache.hpp"
+#include "common.hpp"
+#include "shm.hpp"
+#include "socket.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace rd = rendirt;
+
+namespace {
+    using clock = std::chrono::steady_clock;
+    using frac_ms = std::chrono::duration<float, std::milli>;
+
+    // Maximum size of model data sent inline with a request
+    constexpr size_t MaxInlineSize = size_t(1) << 30;
+
+    // Shared-memory segments are named "/" SegmentPrefix HASH
+    constexpr char SegmentPrefix[] = "rendirt-";
+
+    // A renderable model, either owned by this process or mapped from a
+    // shared-memory segment published by any rendirtd instance.
+    struct CachedModel {
+        rd::Model model;
+        shm::SharedModel shared;
+
+        rd::Face const* data() const {
+            return shared ? shared.data() : model.data();
+        }
+
+        size_t size() const {
+            return shared ? shared.size() : model.size();
+        }
+
+        rd::AABB const& boundingBox() const {
+            return shared ? shared.boundingBox() : model.boundingBox();
+        }
+
+        size_t memory() const {
+            return shared ? shared.size()*sizeof(rd::Face) : model.capacity()*sizeof(rd::Face);
+        }
+
+        // Hierarchy for ray casting, built by the first thread that needs
+        // it. It is not counted in memory()
+        rd::BVH const& hierarchy() const {
+            std::call_once(bvhBuilt, [this] { bvh.build(rd::FaceView(data(), size())); });
+            return bvh;
+        }
+
+        mutable std::once_flag bvhBuilt;
+        mutable rd::BVH bvh;
+    };
+
+    // LRU cache of parsed models with a memory cap. Models are handed out
+    // as shared pointers, so evicting a model that is currently being
+    // rendered is safe: it is freed when the last user is done.
+    class ModelCache {
+    public:
+        using Ptr = std::shared_ptr<const CachedModel>;
+
+        explicit ModelCache(size_t capacity) : capacity_(capacity) {}
+
+        Ptr find(std::string const& key) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = index_.find(key);
+            if (it == index_.end()) {
+                ++misses_;
+                return nullptr;
+            }
+
+            ++hits_;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->model;
+        }
+
+        void insert(std::string const& key, Ptr model) {
+            size_t size = model->memory();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = index_.find(key);
+            if (it != index_.end()) {
+                size_ -= it->second->size;
+                entries_.erase(it->second);
+                index_.erase(it);
+            }
+
+            // Models larger than the whole cache are not retained
+            if (size > capacity_)
+                return;
+
+            while (size_ + size > capacity_ && !entries_.empty()) {
+                size_ -= entries_.back().size;
+                index_.erase(entries_.back().key);
+                entries_.pop_back();
+            }
+
+            entries_.push_front(Entry{ key, std::move(model), size });
+            index_[key] = entries_.begin();
+            size_ += size;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.clear();
+            index_.clear();
+            size_ = 0;
+        }
+
+        void stats(std::ostream& stream) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream << "cache: " << entries_.size() << " models, "
+                   << double(size_)/(1024.0*1024.0) << " MB, "
+                   << hits_ << " hits, " << misses_ << " misses";
+        }
+
+    private:
+        struct Entry {
+            std::string key;
+            Ptr model;
+            size_t size;
+        };
+
+        size_t capacity_;
+        size_t size_ = 0;
+        size_t hits_ = 0, misses_ = 0;
+        std::list<Entry> entries_;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+        std::mutex mutex_;
+    };
+
+    struct Request {
+        std::string model;
+        size_t width = 0, height = 0;
+        std::string shader, camera, format;
+        size_t length = 0;
+    };
+
+    bool parseRequest(std::string const& line, Request& req, std::string& error) {
+        std::istringstream stream(line);
+        std::string command, size;
+
+        if (!(stream >> command) || command != "RENDER") {
+            error = "unknown command";
+            return false;
+        }
+
+        if (!(stream >> req.model >> size >> req.shader >> req.camera >> req.format >> req.length)) {
+            error = "malformed request";
+            return false;
+        }
+
+        if (!tool::parseSize(size, req.width, req.height)) {
+            error = "invalid size";
+            return false;
+        }
+
+        if ((req.model == "-") != (req.length > 0) || req.length > MaxInlineSize) {
+            error = "invalid model length";
+            return false;
+        }
+
+        return true;
+    }
+
+    // When set, parsed models are shared with other processes
+    bool shareModels = false;
+
+    // Connections being served, each by its own thread. Finished ones are
+    // joined by the accept loop; on shutdown the remaining sockets are shut
+    // down, which unblocks pending reads, and their threads are joined.
+    struct Connection {
+        explicit Connection(int socket) : fd(socket) {}
+
+        int fd;
+        bool done = false;
+        std::thread thread;
+    };
+
+    std::mutex connectionsMutex;
+    std::list<Connection> connections;
+
+    // Joins finished connection threads. Returns the number still running
+    size_t reapConnections() {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (it->done) {
+                it->thread.join();
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return connections.size();
+    }
+
+    // Loads the requested model, going through the cache. Path keys include
+    // modification time and size, so edited files are reloaded.
+    ModelCache::Ptr loadModel(ModelCache& cache, Request const& req, sock::Reader& reader,
+                              bool& hit, std::string& error)
+    {
+        std::string key, data;
+
+        if (req.length > 0) {
+            data.resize(req.length);
+            if (!reader.readExact(&data[0], data.size())) {
+                error = "connection lost";
+                return nullptr;
+            }
+
+            key = "data:" + std::to_string(data.size()) + ":" + cache::hash(data).hex();
+        } else {
+            struct stat st;
+            if (::stat(req.model.c_str(), &st) != 0) {
+                error = std::string("cannot stat model: ") + std::strerror(errno);
+                return nullptr;
+            }
+
+            key = "path:" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) +
+                  ":" + std::to_string(st.st_size) + ":" + req.model;
+        }
+
+        ModelCache::Ptr model = cache.find(key);
+        hit = bool(model);
+        if (model)
+            return model;
+
+        std::shared_ptr<CachedModel> loaded = std::make_shared<CachedModel>();
+        std::string segment = "/" + (SegmentPrefix + cache::hash(key).hex());
+
+        // Another process may have parsed this model already
+        if (shareModels) {
+            loaded->shared = shm::SharedModel::open(segment);
+            if (loaded->shared) {
+                cache.insert(key, loaded);
+                return loaded;
+            }
+        }
+
+        rd::Model::Error err;
+
+        if (req.length > 0) {
+            tool::MemoryBuffer buffer(data.data(), data.size());
+            std::istream stream(&buffer);
+            err = loaded->model.loadSTL(stream);
+            data = std::string();
+        } else {
+            std::ifstream file(req.model, std::ifstream::binary);
+            if (!file) {
+                error = std::string("cannot open model: ") + std::strerror(errno);
+                return nullptr;
+            }
+
+            err = loaded->model.loadSTL(file);
+        }
+
+        if (err != rd::Model::Ok) {
+            error = std::string("model load failed: ") + rd::Model::errorString(err);
+            return nullptr;
+        }
+
+        // Move the model to shared memory; if that fails keep the local copy
+        if (shareModels) {
+            loaded->shared = shm::SharedModel::openOrPublish(segment, loaded->model);
+            if (loaded->shared)
+                loaded->model = rd::Model();
+        }
+
+        // Text models grow by doubling: don't keep the slack in the cache
+        loaded->model.shrink_to_fit();
+
+        cache.insert(key, loaded);
+        return loaded;
+    }
+
+    void serve(Connection& connection, ModelCache& cache) {
+        const int fd = connection.fd;
+        sock::Reader reader(fd);
+        tool::Target target;
+        std::string line, error, image;
+
+        while (reader.readLine(line)) {
+            if (line == "STATS") {
+                std::ostringstream stats;
+                stats << "STATS ";
+                cache.stats(stats);
+                if (!sock::writeAll(fd, stats.str() + "\n"))
+                    break;
+                continue;
+            }
+
+            Request req;
+            if (!parseRequest(line, req, error)) {
+                sock::writeAll(fd, "ERR " + error + "\n");
+                break; // Stream position is unknown, drop the connection
+            }
+
+            // Skip the model, if sent inline, rather than loading it
+            // for a render that cannot be encoded
+            if (!tool::isImageFormat(req.format)) {
+                if (!reader.skip(req.length) || !sock::writeAll(fd, "ERR unknown format\n"))
+                    break;
+                continue;
+            }
+
+            bool hit = false;
+            ModelCache::Ptr model = loadModel(cache, req, reader, hit, error);
+            if (!model) {
+                if (!sock::writeAll(fd, "ERR " + error + "\n"))
+                    break;
+                continue;
+            }
+
+            rd::Shader shader;
+            glm::mat4 modelViewProj;
+
+            if (!tool::makeShader(req.shader, model->boundingBox(), shader)) {
+                error = "unknown shader";
+            } else if (!tool::makeCamera(req.camera, model->boundingBox(), req.width, req.height, modelViewProj)) {
+                error = "unknown camera preset";
+            } else {
+                auto start = clock::now();
+
+                target.reset(req.width, req.height);
+
+                // Only models requested again get a hierarchy: its cost is
+                // shared by the renders that follow
+                if (hit && rd::preferRayCasting(model->size(), req.width, req.height, true))
+                    rd::render(target.color, target.depth, rd::FaceView(model->data(), model->size()),
+                               model->hierarchy(), modelViewProj, shader, rd::CullCW, 1);
+                else
+                    rd::render(target.color, target.depth, model->data(), model->size(), modelViewProj, shader);
+
+                float ms = std::chrono::duration_cast<frac_ms>(clock::now() - start).count();
+
+                if (tool::encodeImage(req.format, target.color, image)) {
+                    std::ostringstream header;
+                    header << "OK " << image.size() << " cache:" << (hit ? "hit" : "miss") << " " << ms << "\n";
+                    if (!sock::writeAll(fd, header.str()) || !sock::writeAll(fd, image))
+                        break;
+                    continue;
+                }
+
+                error = "image encoding failed";
+            }
+
+            if (!sock::writeAll(fd, "ERR " + error + "\n"))
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        ::close(fd);
+        connection.fd = -1;
+        connection.done = true;
+    }
+
+    // Removes segments whose holders all died without releasing them.
+    // POSIX offers no way to list segments; Linux exposes them in /dev/shm
+    size_t reclaimSegments() {
+        DIR* dir = ::opendir("/dev/shm");
+        if (!dir)
+            return 0;
+
+        size_t count = 0;
+        while (dirent* entry = ::readdir(dir)) {
+            if (std::strncmp(entry->d_name, SegmentPrefix, sizeof(SegmentPrefix) - 1) == 0 &&
+                shm::SharedModel::reclaim(std::string("/") + entry->d_name))
+                ++count;
+        }
+
+        ::closedir(dir);
+        return count;
+    }
+
+    char const* socketPath = sock::DefaultPath;
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    extern "C" void requestStop(int) {
+        stopRequested = 1;
+    }
+
+    void usage(char const* name) {
+        std::cerr << "Usage: " << name << " [-s SOCKET] [-m CACHE_MB] [-c CONNECTIONS] [-S]\n"
+                  << "Serves render requests over a Unix domain socket\n"
+                  << "(default " << sock::DefaultPath << "), keeping parsed models\n"
+                  << "in an LRU cache limited to CACHE_MB megabytes (default 1024).\n"
+                  << "At most CONNECTIONS clients (default 64) are served at once;\n"
+                  << "further clients get an error reply.\n"
+                  << "With -S, parsed models are published to POSIX shared memory and\n"
+                  << "mapped read-only by other rendirtd processes started with -S."
+                  << std::endl;
+    }
+} /* namespace */
+
+int main(int argc, char* argv[]) {
+    size_t cacheSize = 1024;
+    size_t maxConnections = 64;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            cacheSize = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            maxConnections = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+        } else if (std::strcmp(argv[i], "-S") == 0) {
+            shareModels = true;
+        } else {
+            usage(argv[0]);
+            return (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) ? 0 : -1;
+        }
+    }
+
+    int listener = sock::listenUnix(socketPath);
+    if (listener < 0) {
+        std::cerr << socketPath << ": cannot listen: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+
+    // No SA_RESTART: a signal must interrupt accept() so the loop can exit
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (shareModels) {
+        size_t reclaimed = reclaimSegments();
+        if (reclaimed > 0)
+            std::cerr << "Reclaimed " << reclaimed << " stale shared segments" << std::endl;
+    }
+
+    ModelCache cache(cacheSize*1024*1024);
+
+    std::cerr << "Listening on " << socketPath << std::endl;
+
+    int status = 0;
+
+    while (!stopRequested) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            status = -1;
+            break;
+        }
+
+        if (reapConnections() >= maxConnections) {
+            sock::writeAll(fd, "ERR too many connections\n");
+            ::close(fd);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.emplace_back(fd);
+        connections.back().thread = std::thread(serve, std::ref(connections.back()), std::ref(cache));
+    }
+
+    ::close(listener);
+    ::unlink(socketPath);
+
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (Connection& connection: connections)
+            if (connection.fd >= 0)
+                ::shutdown(connection.fd, SHUT_RDWR);
+    }
+
+    // No connection is added past this point: the list can be walked
+    // without the lock, which finishing threads still take
+    for (Connection& connection: connections)
+        connection.thread.join();
+
+    // Drop cached references so shared segments are unlinked when unused
+    cache.clear();
+    return status;
+}
@@ -0,0 +1,203 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "socket.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator for rendirtd: sends the same render request over several
+// concurrent connections and reports throughput and latency.
+namespace {
+    using clock = std::chrono::steady_clock;
+    using frac_ms = std::chrono::duration<float, std::milli>;
+
+    struct Stats {
+        std::mutex mutex;
+        std::vector<float> latencies;
+        size_t errors = 0;
+        size_t hits = 0;
+        size_t bytes = 0;
+    };
+
+    void run(std::string const& path, std::string const& header, std::string const& payload,
+             std::atomic<long>& remaining, Stats& stats)
+    {
+        int fd = sock::connectUnix(path);
+        if (fd < 0) {
+            std::cerr << path << ": cannot connect: " << std::strerror(errno) << std::endl;
+            std::lock_guard<std::mutex> lock(stats.mutex);
+            ++stats.errors;
+            return;
+        }
+
+        sock::Reader reader(fd);
+        std::vector<float> latencies;
+        std::string line, image;
+        size_t errors = 0, hits = 0, bytes = 0;
+
+        while (remaining.fetch_sub(1) > 0) {
+            auto start = clock::now();
+
+            if (!sock::writeAll(fd, header) || !sock::writeAll(fd, payload) || !reader.readLine(line)) {
+                ++errors;
+                break;
+            }
+
+            std::istringstream reply(line);
+            std::string status, cache;
+            size_t length = 0;
+
+            if (!(reply >> status >> length >> cache) || status != "OK") {
+                if (errors++ == 0)
+                    std::cerr << "server: " << line << std::endl;
+                continue;
+            }
+
+            image.resize(length);
+            if (length && !reader.readExact(&image[0], length)) {
+                ++errors;
+                break;
+            }
+
+            latencies.push_back(std::chrono::duration_cast<frac_ms>(clock::now() - start).count());
+            hits += (cache == "cache:hit");
+            bytes += length;
+        }
+
+        ::close(fd);
+
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        stats.latencies.insert(stats.latencies.end(), latencies.begin(), latencies.end());
+        stats.errors += errors;
+        stats.hits += hits;
+        stats.bytes += bytes;
+    }
+
+    void usage(char const* name) {
+        std::cerr << "Usage: " << name << " [-s SOCKET] [-c CONNECTIONS] [-n REQUESTS] [--inline]\n"
+                  << "       MODEL [WIDTHxHEIGHT] [SHADER] [CAMERA] [FORMAT]\n"
+                  << "Sends REQUESTS (default 1000) render requests for MODEL to rendirtd\n"
+                  << "over CONNECTIONS (default 4) concurrent connections. With --inline,\n"
+                  << "model data is sent with each request instead of its path."
+                  << std::endl;
+    }
+} /* namespace */
+
+int main(int argc, char* argv[]) {
+    std::string path = sock::DefaultPath;
+    size_t connections = 4;
+    long requests = 1000;
+    bool sendInline = false;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            connections = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            requests = std::strtol(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--inline") == 0)
+            sendInline = true;
+        else if (argv[i][0] == '-')
+            return usage(argv[0]), (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) ? 0 : -1;
+        else
+            args.push_back(argv[i]);
+    }
+
+    if (args.empty() || args.size() > 5 || connections == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    static char const* const defaults[] = { "", "256x256", "diffuse", "iso", "tiff" };
+    for (size_t i = args.size(); i < 5; ++i)
+        args.push_back(defaults[i]);
+
+    std::string payload;
+    if (sendInline) {
+        std::ifstream file(args[0], std::ifstream::binary);
+        if (!file) {
+            std::cerr << args[0] << ": cannot open file for reading: " << std::strerror(errno) << std::endl;
+            return -1;
+        }
+
+        payload.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    } else if (args[0][0] != '/') {
+        // The server may run in a different working directory
+        char* cwd = ::getcwd(nullptr, 0);
+        if (cwd) {
+            args[0] = std::string(cwd) + "/" + args[0];
+            std::free(cwd);
+        }
+    }
+
+    std::string header = "RENDER " + (sendInline ? std::string("-") : args[0]) + " " +
+                         args[1] + " " + args[2] + " " + args[3] + " " + args[4] + " " +
+                         std::to_string(payload.size()) + "\n";
+
+    std::atomic<long> remaining(requests);
+    Stats stats;
+    std::vector<std::thread> pool;
+
+    auto start = clock::now();
+
+    for (size_t i = 0; i < connections; ++i)
+        pool.emplace_back(run, std::cref(path), std::cref(header), std::cref(payload),
+                          std::ref(remaining), std::ref(stats));
+
+    for (auto& thread: pool)
+        thread.join();
+
+    float total = std::chrono::duration_cast<frac_ms>(clock::now() - start).count();
+
+    std::vector<float>& lat = stats.latencies;
+    std::sort(lat.begin(), lat.end());
+
+    std::cout << "Requests: " << lat.size() << " ok, " << stats.errors << " failed\n"
+              << "Cache hits: " << stats.hits << '\n'
+              << "Total time: " << total << " ms\n"
+              << "Throughput: " << (total > 0.0f ? lat.size()*1000.0f/total : 0.0f) << " req/s, "
+              << (total > 0.0f ? stats.bytes/(1024.0*1024.0)*1000.0/total : 0.0) << " MB/s\n";
+
+    if (!lat.empty())
+        std::cout << "Latency: min " << lat.front() << " ms, p50 " << lat[lat.size()/2]
+                  << " ms, p99 " << lat[lat.size()*99/100] << " ms, max " << lat.back() << " ms\n";
+
+    std::cout.flush();
+    return stats.errors ? 1 : 0;
+}
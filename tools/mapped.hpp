@@ -0,0 +1,248 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "rendirt.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Out-of-core rendering of binary STL files.
+//
+// The file is memory-mapped and rendered in place, in chunks of faces:
+// once a chunk is done its pages are dropped from the page cache. Resident
+// memory stays bounded by the chunk size plus kernel readahead, whatever
+// the size of the model.
+namespace mapped {
+    class MappedSTL {
+    public:
+        static constexpr size_t HeaderSize = 84;
+        static constexpr size_t RecordSize = 50;
+
+        MappedSTL() = default;
+        MappedSTL(MappedSTL const&) = delete;
+        MappedSTL& operator=(MappedSTL const&) = delete;
+
+        ~MappedSTL() {
+            close();
+        }
+
+        // Maps a binary STL file. Fails with EINVAL if the file is not a
+        // well-formed binary STL: its size must match the face count
+        // exactly, and it must not parse as a text STL (text files are not
+        // supported; their count field reads as at least 0x20202020).
+        bool open(std::string const& path) {
+            close();
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                int err = errno;
+                ::close(fd);
+                errno = err;
+                return false;
+            }
+
+            size_t size = size_t(st.st_size);
+            if (size < HeaderSize) {
+                ::close(fd);
+                errno = EINVAL;
+                return false;
+            }
+
+            void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                errno = err;
+                return false;
+            }
+
+            fd_ = fd;
+            data_ = static_cast<unsigned char const*>(data);
+            size_ = size;
+
+            std::uint32_t count;
+            std::memcpy(&count, data_ + 80, sizeof(count));
+            if (size_ != HeaderSize + size_t(count)*RecordSize || isText(data_, size_)) {
+                close();
+                errno = EINVAL;
+                return false;
+            }
+
+            count_ = count;
+            ::madvise(const_cast<unsigned char*>(data_), size_, MADV_SEQUENTIAL);
+            ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+            return true;
+        }
+
+        // Returns true if data starts with "solid" and the line after it
+        // opens a facet or ends the solid. Binary files may also start with
+        // "solid" in their header, but are followed by raw records.
+        static bool isText(unsigned char const* data, size_t size) {
+            static constexpr size_t MaxHeaderLine = 1024;
+
+            size_t i = 0;
+            while (i < size && std::isspace(data[i]))
+                ++i;
+
+            if (size - i < 6 || std::memcmp(data + i, "solid", 5) != 0 || !std::isspace(data[i + 5]))
+                return false;
+
+            const size_t end = std::min(size, i + MaxHeaderLine);
+            while (i < end && data[i] != '\n')
+                ++i;
+            while (i < size && std::isspace(data[i]))
+                ++i;
+
+            return (size - i >= 5 && std::memcmp(data + i, "facet", 5) == 0) ||
+                   (size - i >= 8 && std::memcmp(data + i, "endsolid", 8) == 0);
+        }
+
+        void close() {
+            if (data_)
+                ::munmap(const_cast<unsigned char*>(data_), size_);
+            if (fd_ >= 0)
+                ::close(fd_);
+            fd_ = -1;
+            data_ = nullptr;
+            size_ = count_ = 0;
+        }
+
+        size_t size() const {
+            return count_;
+        }
+
+        // Returns a view of the mapped records. Normals are recomputed from
+        // vertex data, like Model::loadSTL does by default.
+        rendirt::FaceView faces() const {
+            return rendirt::FaceView::fromBinarySTL(data_, size_);
+        }
+
+        // Hints the kernel to start reading faces [first, first + count)
+        void prefetch(size_t first, size_t count) const {
+            advise(first, count, MADV_WILLNEED);
+        }
+
+        // Unmaps pages fully contained in faces [first, first + count) and
+        // evicts them from the page cache, so that streaming a huge model
+        // does not push other data out of memory
+        void release(size_t first, size_t count) const {
+            advise(first, count, MADV_DONTNEED);
+        }
+
+    private:
+        void advise(size_t first, size_t count, int advice) const {
+            static const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+
+            size_t from = HeaderSize + first*RecordSize;
+            size_t to = HeaderSize + (first + count)*RecordSize;
+
+            // Round inwards for DONTNEED (neighbouring chunks may still need
+            // partial pages), outwards otherwise
+            if (advice == MADV_DONTNEED) {
+                from = (from + page - 1) & ~(page - 1);
+                to &= ~(page - 1);
+            } else {
+                from &= ~(page - 1);
+                to = std::min((to + page - 1) & ~(page - 1), size_);
+            }
+
+            if (from >= to)
+                return;
+
+            ::madvise(const_cast<unsigned char*>(data_) + from, to - from, advice);
+            if (advice == MADV_DONTNEED)
+                ::posix_fadvise(fd_, off_t(from), off_t(to - from), POSIX_FADV_DONTNEED);
+        }
+
+        int fd_ = -1;
+        unsigned char const* data_ = nullptr;
+        size_t size_ = 0;
+        size_t count_ = 0;
+    };
+
+    constexpr size_t DefaultChunkSize = size_t(1) << 16;
+
+    // Computes the bounding box in a single sequential pass
+    inline rendirt::AABB boundingBox(MappedSTL const& stl, size_t chunkSize = DefaultChunkSize) {
+        rendirt::FaceView faces = stl.faces();
+        rendirt::AABB box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+        bool first = true;
+
+        for (size_t start = 0; start < stl.size(); start += chunkSize) {
+            size_t count = std::min(chunkSize, stl.size() - start);
+            if (start + count < stl.size())
+                stl.prefetch(start + count, std::min(chunkSize, stl.size() - start - count));
+
+            for (size_t i = start, end = start + count; i < end; ++i) {
+                const rendirt::Face face = faces[i];
+                glm::vec3 lo = glm::min(face.vertex[0], glm::min(face.vertex[1], face.vertex[2]));
+                glm::vec3 hi = glm::max(face.vertex[0], glm::max(face.vertex[1], face.vertex[2]));
+
+                box.from = first ? lo : glm::min(box.from, lo);
+                box.to = first ? hi : glm::max(box.to, hi);
+                first = false;
+            }
+
+            stl.release(start, count);
+        }
+
+        return box;
+    }
+
+    // Renders all faces chunk by chunk. Same semantics as rendirt::render.
+    inline size_t render(rendirt::Image<rendirt::Color> const& color, rendirt::Image<float> const& depth,
+                         MappedSTL const& stl, glm::mat4 const& modelViewProj,
+                         rendirt::Shader const& shader, rendirt::CullingMode cullingMode = rendirt::CullCW,
+                         size_t chunkSize = DefaultChunkSize)
+    {
+        rendirt::FaceView faces = stl.faces();
+        size_t rendered = 0;
+
+        for (size_t start = 0; start < stl.size(); start += chunkSize) {
+            size_t count = std::min(chunkSize, stl.size() - start);
+            if (start + count < stl.size())
+                stl.prefetch(start + count, std::min(chunkSize, stl.size() - start - count));
+
+            rendered += rendirt::render(color, depth, faces.slice(start, count), modelViewProj, shader, cullingMode);
+            stl.release(start, count);
+        }
+
+        return rendered;
+    }
+} /* namespace mapped */
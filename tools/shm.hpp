@@ -0,0 +1,354 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "rendirt.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Sharing of loaded models between processes through named POSIX
+// shared-memory segments.
+//
+// A segment starts with a one-page header holding the face count, bounding
+// box and a table of holders, followed by the face array. The header is
+// mapped read-write (for reference counting), faces are mapped read-only
+// and rendered in place through the pointer-based render() overload.
+//
+// Every SharedModel handle, including the publisher's, holds a slot in the
+// table, marked with the pid of its process. When the last live holder is
+// released the segment name is unlinked, and the memory is returned to the
+// system once every process has unmapped it. Slots of processes that died
+// without releasing them are detected with kill(pid, 0) and recycled, so a
+// crash does not pin the segment forever; this assumes that all holders
+// share a pid namespace. Segments left with no live holder at all are
+// removed by reclaim().
+namespace shm {
+    class SharedModel {
+    public:
+        SharedModel() = default;
+        SharedModel(SharedModel const&) = delete;
+        SharedModel& operator=(SharedModel const&) = delete;
+
+        SharedModel(SharedModel&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        SharedModel& operator=(SharedModel&& other) noexcept {
+            if (this != &other) {
+                release();
+                name_ = std::move(other.name_);
+                header_ = other.header_;
+                faces_ = other.faces_;
+                slot_ = other.slot_;
+                other.header_ = nullptr;
+                other.faces_ = nullptr;
+            }
+            return *this;
+        }
+
+        ~SharedModel() {
+            release();
+        }
+
+        // Copies model into a new segment. Fails (returning an invalid handle
+        // and setting errno) if a segment with the same name already exists.
+        // Names must start with '/' and contain no other slashes.
+        static SharedModel publish(std::string const& name, rendirt::Model const& model) {
+            SharedModel shared;
+
+            int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (fd < 0)
+                return shared;
+
+            size_t dataSize = model.size()*sizeof(rendirt::Face);
+            if (::ftruncate(fd, off_t(headerSize() + dataSize)) != 0 || !shared.map(fd, model.size(), true)) {
+                int err = errno;
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                errno = err;
+                return shared;
+            }
+
+            ::close(fd);
+
+            // The publisher takes the first slot before writing anything, so
+            // that readers can tell an abandoned segment from one in progress
+            shared.claimSlot();
+
+            std::memcpy(const_cast<rendirt::Face*>(shared.faces_), model.data(), dataSize);
+            ::mprotect(const_cast<rendirt::Face*>(shared.faces_), roundUp(dataSize), PROT_READ);
+
+            shared.name_ = name;
+            shared.header_->faceCount = model.size();
+            shared.header_->boundingBox = model.boundingBox();
+
+            // Publishing the magic number last makes the segment visible
+            // to readers only once it is complete.
+            shared.header_->magic.store(Magic, std::memory_order_release);
+            return shared;
+        }
+
+        // Maps an existing segment. Returns an invalid handle if it does not
+        // exist, is still being written, or is being torn down. A segment
+        // whose publisher died before completing it is unlinked.
+        static SharedModel open(std::string const& name) {
+            SharedModel shared;
+            size_t faceCount;
+            if (!shared.mapExisting(name, faceCount))
+                return shared;
+
+            if (shared.header_->magic.load(std::memory_order_acquire) != Magic ||
+                shared.header_->faceCount != faceCount)
+            {
+                bool removed = shared.abandoned() && shared.close(name);
+                shared.unmap(faceCount);
+                errno = removed ? ENOENT : EAGAIN;
+                return shared;
+            }
+
+            if (!shared.claimSlot()) {
+                shared.unmap(faceCount);
+                return shared;
+            }
+
+            // The last holder may have released the segment in the meantime
+            if (shared.header_->closed.load() != 0) {
+                shared.header_->holders[shared.slot_].store(0);
+                shared.unmap(faceCount);
+                errno = ENOENT;
+                return shared;
+            }
+
+            shared.name_ = name;
+            return shared;
+        }
+
+        // Opens the named segment, or publishes model under that name if
+        // it does not exist yet.
+        static SharedModel openOrPublish(std::string const& name, rendirt::Model const& model) {
+            SharedModel shared = publish(name, model);
+            if (!shared)
+                shared = open(name);
+
+            // The existing segment was torn down or abandoned: take its place
+            if (!shared && errno == ENOENT)
+                shared = publish(name, model);
+
+            return shared;
+        }
+
+        // Unlinks the named segment if no live process holds it, e.g. after
+        // every holder crashed. Returns true if the segment was removed.
+        static bool reclaim(std::string const& name) {
+            SharedModel shared;
+            size_t faceCount;
+            if (!shared.mapExisting(name, faceCount))
+                return false;
+
+            bool complete = shared.header_->magic.load(std::memory_order_acquire) == Magic;
+            bool removed = (complete ? !shared.held() : shared.abandoned()) && shared.close(name);
+
+            shared.unmap(faceCount);
+            return removed;
+        }
+
+        explicit operator bool() const {
+            return header_ != nullptr;
+        }
+
+        rendirt::Face const* data() const {
+            return faces_;
+        }
+
+        size_t size() const {
+            return header_ ? size_t(header_->faceCount) : 0;
+        }
+
+        rendirt::AABB const& boundingBox() const {
+            return header_->boundingBox;
+        }
+
+        std::string const& name() const {
+            return name_;
+        }
+
+        // Drops this handle's reference; unlinks the segment if no live
+        // holder remains
+        void release() {
+            if (!header_)
+                return;
+
+            size_t faceCount = header_->faceCount;
+            header_->holders[slot_].store(0);
+            if (!held())
+                close(name_);
+
+            unmap(faceCount);
+            name_.clear();
+        }
+
+    private:
+        static constexpr std::uint64_t Magic = 0x32544d4852444e52ull; // "RNDRHMT2"
+        static constexpr size_t MaxHolders = 256;
+
+        struct Header {
+            std::atomic<std::uint64_t> magic;
+            std::atomic<std::uint32_t> closed;
+            std::uint64_t faceCount;
+            rendirt::AABB boundingBox;
+            std::atomic<std::int32_t> holders[MaxHolders];
+        };
+
+        static bool alive(std::int32_t pid) {
+            return ::kill(pid_t(pid), 0) == 0 || errno == EPERM;
+        }
+
+        // Takes a free slot, or one left by a dead process
+        bool claimSlot() {
+            const std::int32_t self = std::int32_t(::getpid());
+            for (size_t i = 0; i < MaxHolders; ++i) {
+                std::int32_t pid = header_->holders[i].load();
+                if ((pid == 0 || !alive(pid)) && header_->holders[i].compare_exchange_strong(pid, self)) {
+                    slot_ = i;
+                    return true;
+                }
+            }
+
+            errno = EBUSY;
+            return false;
+        }
+
+        // Returns true if a live process holds the segment. Slots of dead
+        // processes are cleared on the way
+        bool held() const {
+            bool result = false;
+            for (auto& holder: header_->holders) {
+                std::int32_t pid = holder.load();
+                if (pid == 0)
+                    continue;
+                if (alive(pid))
+                    result = true;
+                else
+                    holder.compare_exchange_strong(pid, 0);
+            }
+            return result;
+        }
+
+        // An incomplete segment is abandoned once its publisher is gone
+        bool abandoned() const {
+            std::int32_t publisher = header_->holders[0].load();
+            return publisher != 0 && !alive(publisher);
+        }
+
+        // Marks the segment closed and unlinks its name. Only the first
+        // caller unlinks, so a segment published later under the same
+        // name is never removed by mistake
+        bool close(std::string const& name) {
+            std::uint32_t expected = 0;
+            if (!header_->closed.compare_exchange_strong(expected, 1))
+                return false;
+
+            ::shm_unlink(name.c_str());
+            return true;
+        }
+
+        bool mapExisting(std::string const& name, size_t& faceCount) {
+            int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || size_t(st.st_size) < headerSize()) {
+                ::close(fd);
+                errno = EINVAL;
+                return false;
+            }
+
+            faceCount = (size_t(st.st_size) - headerSize())/sizeof(rendirt::Face);
+            bool mapped = map(fd, faceCount, false);
+            ::close(fd);
+            return mapped;
+        }
+
+        static size_t pageSize() {
+            static const size_t size = size_t(::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+
+        static size_t roundUp(size_t size) {
+            return (size + pageSize() - 1) & ~(pageSize() - 1);
+        }
+
+        static size_t headerSize() {
+            return roundUp(sizeof(Header));
+        }
+
+        bool map(int fd, size_t faceCount, bool writable) {
+            void* header = ::mmap(nullptr, headerSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (header == MAP_FAILED)
+                return false;
+
+            void* faces = nullptr;
+            if (faceCount > 0) {
+                faces = ::mmap(nullptr, roundUp(faceCount*sizeof(rendirt::Face)),
+                               writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                               MAP_SHARED, fd, off_t(headerSize()));
+                if (faces == MAP_FAILED) {
+                    int err = errno;
+                    ::munmap(header, headerSize());
+                    errno = err;
+                    return false;
+                }
+            }
+
+            header_ = static_cast<Header*>(header);
+            faces_ = static_cast<rendirt::Face const*>(faces);
+            return true;
+        }
+
+        void unmap(size_t faceCount) {
+            if (faces_)
+                ::munmap(const_cast<rendirt::Face*>(faces_), roundUp(faceCount*sizeof(rendirt::Face)));
+            ::munmap(header_, headerSize());
+            header_ = nullptr;
+            faces_ = nullptr;
+        }
+
+        std::string name_;
+        Header* header_ = nullptr;
+        rendirt::Face const* faces_ = nullptr;
+        size_t slot_ = 0;
+    };
+} /* namespace shm */
@@ -0,0 +1,223 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Fabio Massaioli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+// Minimal Unix domain socket helpers for the render daemon and its clients.
+//
+// Protocol: each request is a single text line
+//   RENDER <path|-> <WIDTHxHEIGHT> <shader> <camera> <format> <length>
+// followed by <length> bytes of STL data when the model is given as '-'
+// (length must be 0 otherwise). Formats: tiff, bmp, rgba (raw pixels).
+// The server replies with either
+//   OK <length> <cache:hit|miss> <render_ms>
+// followed by <length> bytes of encoded image, or
+//   ERR <message>
+// The single-line request STATS is answered with a line of cache statistics.
+// Connections are persistent: clients may send any number of requests.
+namespace sock {
+    static constexpr char const* DefaultPath = "/tmp/rendirtd.sock";
+
+    inline bool makeAddress(std::string const& path, sockaddr_un& addr) {
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // Returns a connected socket or -1 on error
+    inline int connectUnix(std::string const& path) {
+        sockaddr_un addr;
+        if (!makeAddress(path, addr))
+            return -1;
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    // Returns a listening socket or -1 on error. A socket file left by a
+    // server that is gone is replaced; if a server still answers on path,
+    // fails with EADDRINUSE, and if path is not a socket, with EEXIST.
+    inline int listenUnix(std::string const& path, int backlog = 64) {
+        sockaddr_un addr;
+        if (!makeAddress(path, addr))
+            return -1;
+
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                errno = EEXIST;
+                return -1;
+            }
+
+            int live = connectUnix(path);
+            if (live >= 0) {
+                ::close(live);
+                errno = EADDRINUSE;
+                return -1;
+            }
+
+            ::unlink(path.c_str());
+        }
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, backlog) < 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    inline bool writeAll(int fd, void const* data, size_t size) {
+        char const* p = static_cast<char const*>(data);
+        while (size > 0) {
+            ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            else if (n <= 0)
+                return false;
+
+            p += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    inline bool writeAll(int fd, std::string const& str) {
+        return writeAll(fd, str.data(), str.size());
+    }
+
+    // Buffered reader over a socket
+    class Reader {
+    public:
+        explicit Reader(int fd) : fd_(fd) {}
+
+        // Reads a line without the terminating newline. Returns false on
+        // error, end of stream or when the line exceeds maxLength.
+        bool readLine(std::string& line, size_t maxLength = 4096) {
+            line.clear();
+
+            for (;;) {
+                char const* start = buffer_ + begin_;
+                char const* nl = static_cast<char const*>(std::memchr(start, '\n', end_ - begin_));
+                if (nl) {
+                    line.append(start, nl);
+                    begin_ = (nl - buffer_) + 1;
+                    return true;
+                }
+
+                line.append(buffer_ + begin_, buffer_ + end_);
+                begin_ = end_ = 0;
+
+                if (line.size() > maxLength || !fill())
+                    return false;
+            }
+        }
+
+        // Discards size bytes. Returns false on error or end of stream
+        bool skip(size_t size) {
+            char scratch[4096];
+            while (size > 0) {
+                size_t n = std::min(size, sizeof(scratch));
+                if (!readExact(scratch, n))
+                    return false;
+                size -= n;
+            }
+            return true;
+        }
+
+        bool readExact(void* data, size_t size) {
+            char* p = static_cast<char*>(data);
+
+            size_t buffered = std::min(size, end_ - begin_);
+            std::memcpy(p, buffer_ + begin_, buffered);
+            begin_ += buffered;
+            p += buffered;
+            size -= buffered;
+
+            while (size > 0) {
+                ssize_t n = ::recv(fd_, p, size, 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                else if (n <= 0)
+                    return false;
+
+                p += n;
+                size -= n;
+            }
+
+            return true;
+        }
+
+    private:
+        bool fill() {
+            for (;;) {
+                ssize_t n = ::recv(fd_, buffer_, sizeof(buffer_), 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                else if (n <= 0)
+                    return false;
+
+                end_ = n;
+                return true;
+            }
+        }
+
+        int fd_;
+        size_t begin_ = 0, end_ = 0;
+        char buffer_[4096];
+    };
+} /* namespace sock */